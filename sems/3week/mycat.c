@@ -1,8 +1,34 @@
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+// сколько байт просим у ядра за один вызов splice/sendfile
+#define KERNEL_COPY_CHUNK (1UL << 30)
+
+// файлы от MMAP_MIN_SIZE читаем через mmap окнами по MMAP_WINDOW, если ядро не справилось само
+#define MMAP_MIN_SIZE     ((off_t)1 << 20)
+#define MMAP_WINDOW       ((off_t)64 << 20)
+
+// фоновый поток открывает до PREFETCH_DEPTH файлов вперед и
+// просит ядро заранее прочитать первые PREFETCH_READAHEAD байт каждого
+#define PREFETCH_DEPTH     16
+#define PREFETCH_READAHEAD ((off_t)4 << 20)
+
+enum copy_status_t {
+    COPY_FAILED   = -1,
+    COPY_DONE     =  0,
+    COPY_FALLBACK =  1,
+};
 
 ssize_t safewrite(int fd, const void* buffer, size_t size) {
     assert(buffer);
@@ -43,24 +69,258 @@ void stream(int fd_IN, int fd_OUT) {
     }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc == 1) {
-        stream(STDIN_FILENO, STDOUT_FILENO);
-    } else {
-        for (int file_ind=1; file_ind < argc; file_ind++) {
-            int fd = 0;
-            fd = open(argv[file_ind], O_RDONLY);
-            if (fd < 0) {
-                perror("Error while opening file in O_RDONLY mode: ");
+// ядро не умеет перекладывать данные между этими fd - остается stream()
+static bool is_fallback_errno(int err) {
+    return err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == EBADF || err == ESPIPE;
+}
+
+static bool is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+// splice двигает страницы между fd без копии в user space, но одним из концов обязан быть pipe
+enum copy_status_t copy_with_splice(int fd_IN, int fd_OUT) {
+    while (true) {
+        ssize_t moved = splice(fd_IN, NULL, fd_OUT, NULL, KERNEL_COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            stream(fd, STDOUT_FILENO);
-            int close_res = close(fd);
-            if (close_res < 0) {
-                perror("Error while closing file: ");
+            if (is_fallback_errno(errno)) {
+                return COPY_FALLBACK;
+            }
+            perror("Error in splice");
+            return COPY_FAILED;
+        }
+        if (moved == 0) {
+            return COPY_DONE;
+        }
+    }
+}
+
+// файл -> файл (или сокет): pipe нет, зато вход умеет mmap, что нужно sendfile
+enum copy_status_t copy_with_sendfile(int fd_IN, int fd_OUT) {
+    while (true) {
+        ssize_t copied = sendfile(fd_OUT, fd_IN, NULL, KERNEL_COPY_CHUNK);
+        if (copied < 0) {
+            if (errno == EINTR) {
                 continue;
             }
+            if (is_fallback_errno(errno)) {
+                return COPY_FALLBACK;
+            }
+            perror("Error in sendfile");
+            return COPY_FAILED;
         }
+        if (copied == 0) {
+            return COPY_DONE;
+        }
+    }
+}
+
+// Окно файла отображается в память и уходит одним write(): никакого промежуточного
+// буфера, а MADV_SEQUENTIAL разрешает ядру читать вперед и сразу освобождать прочитанное.
+// Файл могут укоротить на ходу (logrotate с copytruncate). Поэтому размер сверяется
+// перед каждым окном, а страницы, исчезнувшие уже после mmap, write() не скопирует:
+// он запишет меньше или вернет EFAULT. Тогда остаток дочитывает stream() с того же места
+enum copy_status_t copy_with_mmap(int fd_IN, int fd_OUT, off_t size) {
+    off_t page   = sysconf(_SC_PAGESIZE);
+    off_t offset = lseek(fd_IN, 0, SEEK_CUR);
+    if (offset < 0) {
+        return COPY_FALLBACK;
+    }
+
+    while (true) {
+        struct stat st;
+        if (fstat(fd_IN, &st) < 0) {
+            return COPY_FALLBACK;
+        }
+        if (st.st_size < size) {
+            size = st.st_size;
+        }
+        if (offset >= size) {
+            return COPY_DONE;
+        }
+
+        off_t start  = offset / page * page;
+        off_t length = size - start < MMAP_WINDOW ? size - start : MMAP_WINDOW;
+        char* window = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd_IN, start);
+        if (window == MAP_FAILED) {
+            return COPY_FALLBACK;
+        }
+        madvise(window, length, MADV_SEQUENTIAL);
+
+        bool truncated = false;
+        while (offset < start + length) {
+            ssize_t written = write(fd_OUT, window + (offset - start), start + length - offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written < 0 && errno == EFAULT) {
+                truncated = true;
+                break;
+            }
+            if (written < 0) {
+                perror("Error in write");
+                munmap(window, length);
+                return COPY_FAILED;
+            }
+            offset += written;
+        }
+        munmap(window, length);
+        // держим смещение fd актуальным, чтобы stream() мог продолжить с него
+        lseek(fd_IN, offset, SEEK_SET);
+        if (truncated) {
+            return COPY_FALLBACK;
+        }
+    }
+}
+
+// Выбор самого дешевого пути под пару fd:
+//  - в pipe или из pipe - splice, данные не выходят в user space;
+//  - обычный файл в не-pipe - sendfile;
+//  - если ядро отказалось, большой обычный файл читаем через mmap, остальное - stream().
+// Для обычного файла заранее включаем агрессивное чтение вперед.
+// Все пути двигают смещение входа, поэтому следующий продолжает с места предыдущего
+void cat_fd(int fd_IN, int fd_OUT) {
+    struct stat st_IN;
+    bool regular_IN = fstat(fd_IN, &st_IN) == 0 && S_ISREG(st_IN.st_mode);
+    if (regular_IN) {
+        posix_fadvise(fd_IN, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    enum copy_status_t status = COPY_FALLBACK;
+    if (is_pipe(fd_IN) || is_pipe(fd_OUT)) {
+        status = copy_with_splice(fd_IN, fd_OUT);
+    } else {
+        status = copy_with_sendfile(fd_IN, fd_OUT);
+    }
+    if (status == COPY_FALLBACK && regular_IN && st_IN.st_size >= MMAP_MIN_SIZE) {
+        status = copy_with_mmap(fd_IN, fd_OUT, st_IN.st_size);
+    }
+    if (status == COPY_FALLBACK) {
+        stream(fd_IN, fd_OUT);
+    }
+}
+
+// Открытые заранее файлы. Поток-предвыборщик открывает их строго по порядку,
+// главный поток забирает тоже по порядку, так что вывод не перемешивается
+struct prefetcher_t {
+    char* const* paths;
+    size_t count;
+    int* fds;
+    int* errnos;
+
+    size_t opened;          // сколько файлов уже открыто (или не открылось)
+    size_t consumed;        // сколько уже забрал главный поток
+
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t space;
+};
+
+static void* prefetch_worker(void* arg) {
+    struct prefetcher_t* pf = arg;
+
+    for (size_t i = 0; i < pf->count; i++) {
+        pthread_mutex_lock(&pf->lock);
+        while (i - pf->consumed >= PREFETCH_DEPTH) {
+            pthread_cond_wait(&pf->space, &pf->lock);
+        }
+        pthread_mutex_unlock(&pf->lock);
+
+        int fd  = open(pf->paths[i], O_RDONLY);
+        int err = errno;
+        if (fd >= 0) {
+            // WILLNEED на начало файла: остальное догонит обычное чтение вперед
+            posix_fadvise(fd, 0, PREFETCH_READAHEAD, POSIX_FADV_WILLNEED);
+        }
+
+        pthread_mutex_lock(&pf->lock);
+        pf->fds[i]    = fd;
+        pf->errnos[i] = err;
+        pf->opened    = i + 1;
+        pthread_cond_signal(&pf->ready);
+        pthread_mutex_unlock(&pf->lock);
+    }
+    return NULL;
+}
+
+static int prefetch_take(struct prefetcher_t* pf, size_t index, int* err) {
+    pthread_mutex_lock(&pf->lock);
+    while (pf->opened <= index) {
+        pthread_cond_wait(&pf->ready, &pf->lock);
+    }
+    int fd = pf->fds[index];
+    *err   = pf->errnos[index];
+    pf->consumed = index + 1;
+    pthread_cond_signal(&pf->space);
+    pthread_mutex_unlock(&pf->lock);
+    return fd;
+}
+
+static void cat_opened_fd(int fd, int err) {
+    if (fd < 0) {
+        errno = err;
+        perror("Error while opening file in O_RDONLY mode: ");
+        return;
+    }
+    cat_fd(fd, STDOUT_FILENO);
+    int close_res = close(fd);
+    if (close_res < 0) {
+        perror("Error while closing file: ");
+    }
+}
+
+// Пока текущий файл выводится, следующие уже открываются и читаются вперед
+void cat_files(char* const* paths, size_t count) {
+    struct prefetcher_t pf = {
+        .paths  = paths,
+        .count  = count,
+        .fds    = calloc(count, sizeof(int)),
+        .errnos = calloc(count, sizeof(int)),
+    };
+    pthread_t thread;
+    bool threaded = pf.fds != NULL && pf.errnos != NULL;
+    if (threaded) {
+        pthread_mutex_init(&pf.lock, NULL);
+        pthread_cond_init(&pf.ready, NULL);
+        pthread_cond_init(&pf.space, NULL);
+        threaded = pthread_create(&thread, NULL, prefetch_worker, &pf) == 0;
+        if (! threaded) {
+            pthread_mutex_destroy(&pf.lock);
+            pthread_cond_destroy(&pf.ready);
+            pthread_cond_destroy(&pf.space);
+        }
+    }
+
+    if (! threaded) {
+        // без потока работаем по-старому: открыли, вывели, закрыли
+        for (size_t i = 0; i < count; i++) {
+            int fd = open(paths[i], O_RDONLY);
+            cat_opened_fd(fd, errno);
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            int err = 0;
+            int fd  = prefetch_take(&pf, i, &err);
+            cat_opened_fd(fd, err);
+        }
+        pthread_join(thread, NULL);
+        pthread_mutex_destroy(&pf.lock);
+        pthread_cond_destroy(&pf.ready);
+        pthread_cond_destroy(&pf.space);
+    }
+    free(pf.fds);
+    free(pf.errnos);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 1) {
+        cat_fd(STDIN_FILENO, STDOUT_FILENO);
+    } else {
+        cat_files(argv + 1, argc - 1);
     }
 
     return 0;
@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "mycp.h"
+
+// Бенчмарк движков копирования mycp. Печатает CSV в stdout:
+// input,cache,strategy,buffer,bytes,seconds,mb_per_s,syscalls_per_mb,user_s,sys_s,status
+//
+//  -s SIZE_MB   размер большого плотного и разреженного файла (по умолчанию 1024)
+//  -n COUNT     сколько маленьких файлов (по умолчанию 1000)
+//  -d DIR       рабочий каталог для входных данных (по умолчанию bench_data)
+
+#define BENCH_TINY_SIZE     4096
+#define BENCH_SPARSE_STEP   ((off_t)10 << 20)     // в разреженном файле 1 МБ данных на каждые 10 МБ
+#define BENCH_JOBS          4
+
+struct bench_input_t {
+    const char* name;
+    char** paths;
+    size_t count;
+    off_t total_bytes;
+};
+
+struct bench_sample_t {
+    double seconds;
+    double user_s;
+    double sys_s;
+    unsigned long long syscalls;
+};
+
+typedef enum copy_status_t (*fd_strategy_t)(int fd_IN, int fd_OUT, off_t size, size_t buffer_size);
+
+struct bench_strategy_t {
+    const char* name;
+    fd_strategy_t run;
+    size_t buffer_size;     // 0 - стратегия сама выбирает буфер
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// syscr + syscw из /proc/self/io: read-, write-, sendfile- и copy_file_range-подобные вызовы.
+// Если учет ввода-вывода в ядре выключен, вернется 0 и колонка будет нулевой.
+// Вызовы io_uring сюда не попадают, их добавляет bench_uring через uring_syscall_count()
+static unsigned long long io_syscalls() {
+    FILE* io = fopen("/proc/self/io", "r");
+    if (io == NULL) {
+        return 0;
+    }
+    unsigned long long total = 0;
+    char key[64];
+    unsigned long long value = 0;
+    while (fscanf(io, "%63[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0 || strcmp(key, "syscw") == 0) {
+            total += value;
+        }
+    }
+    fclose(io);
+    return total;
+}
+
+static void sample_begin(struct bench_sample_t* sample) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    sample->user_s   = -timeval_seconds(usage.ru_utime);
+    sample->sys_s    = -timeval_seconds(usage.ru_stime);
+    sample->syscalls = io_syscalls();
+    sample->seconds  = -now_seconds();
+}
+
+static void sample_end(struct bench_sample_t* sample) {
+    sample->seconds += now_seconds();
+    unsigned long long syscalls = io_syscalls();
+    sample->syscalls = syscalls > sample->syscalls ? syscalls - sample->syscalls : 0;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    sample->user_s += timeval_seconds(usage.ru_utime);
+    sample->sys_s  += timeval_seconds(usage.ru_stime);
+}
+
+static enum copy_status_t run_stream(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)size;
+    return stream(fd_IN, fd_OUT, buffer_size);
+}
+
+static enum copy_status_t run_direct(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)size;
+    return copy_direct(fd_IN, fd_OUT, buffer_size);
+}
+
+static enum copy_status_t run_copy_file_range(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)buffer_size;
+    return copy_with_file_range(fd_IN, fd_OUT, size);
+}
+
+static enum copy_status_t run_sendfile(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)size;
+    (void)buffer_size;
+    return copy_with_sendfile(fd_IN, fd_OUT);
+}
+
+static enum copy_status_t run_sparse(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)buffer_size;
+    return copy_sparse(fd_IN, fd_OUT, size, false);
+}
+
+static enum copy_status_t run_parallel(int fd_IN, int fd_OUT, off_t size, size_t buffer_size) {
+    (void)buffer_size;
+    struct flags_states flags = {.jobs = BENCH_JOBS};
+    return copy_parallel(fd_IN, fd_OUT, size, &flags);
+}
+
+static const struct bench_strategy_t strategies[] = {
+    {"stream",          run_stream,          4096},
+    {"stream",          run_stream,          BUFSIZ},
+    {"stream",          run_stream,          64 * 1024},
+    {"stream",          run_stream,          1024 * 1024},
+    {"direct",          run_direct,          1024 * 1024},
+    {"copy_file_range", run_copy_file_range, 0},
+    {"sendfile",        run_sendfile,        0},
+    {"sparse",          run_sparse,          0},
+    {"parallel",        run_parallel,        0},
+};
+
+static char* make_path(const char* dir, const char* name, size_t index) {
+    char path[BUFSIZ];
+    snprintf(path, sizeof(path), "%s/%s.%zu", dir, name, index);
+    return strdup(path);
+}
+
+// Пишет size байт случайных данных; с sparse пишет только первый мегабайт каждого шага
+static int generate_file(const char* path, off_t size, bool sparse) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error while creating bench input");
+        return -1;
+    }
+    size_t block_size = 1 << 20;
+    char* block = malloc(block_size);
+    if (block == NULL) {
+        close(fd);
+        return -1;
+    }
+    unsigned seed = 42;
+    for (size_t i = 0; i < block_size; i++) {
+        block[i] = rand_r(&seed);
+    }
+
+    int res = 0;
+    for (off_t offset = 0; offset < size && res == 0; offset += block_size) {
+        if (sparse && offset % BENCH_SPARSE_STEP != 0) {
+            continue;
+        }
+        size_t len = size - offset < (off_t)block_size ? (size_t)(size - offset) : block_size;
+        if (pwrite(fd, block, len, offset) != (ssize_t)len) {
+            perror("Error while writing bench input");
+            res = -1;
+        }
+    }
+    if (res == 0 && (ftruncate(fd, size) < 0 || fsync(fd) < 0)) {
+        perror("Error while finishing bench input");
+        res = -1;
+    }
+    free(block);
+    close(fd);
+    return res;
+}
+
+static bool make_input(struct bench_input_t* input, const char* dir, const char* name,
+                       size_t count, off_t size, bool sparse) {
+    input->name        = name;
+    input->count       = count;
+    input->total_bytes = (off_t)count * size;
+    input->paths       = calloc(count, sizeof(*input->paths));
+    if (input->paths == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        input->paths[i] = make_path(dir, name, i);
+        if (input->paths[i] == NULL || generate_file(input->paths[i], size, sparse) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void free_input(struct bench_input_t* input) {
+    for (size_t i = 0; i < input->count && input->paths != NULL; i++) {
+        if (input->paths[i] != NULL) {
+            unlink(input->paths[i]);
+            free(input->paths[i]);
+        }
+    }
+    free(input->paths);
+}
+
+// cold: выкидываем источник из page cache, hot: прочитываем его целиком заранее
+static void prepare_cache(const struct bench_input_t* input, bool hot) {
+    char buffer[1 << 16];
+    for (size_t i = 0; i < input->count; i++) {
+        int fd = open(input->paths[i], O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (hot) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            while (read(fd, buffer, sizeof(buffer)) > 0)
+                continue;
+        } else {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        close(fd);
+    }
+}
+
+// Копии сбрасываются на диск и удаляются вне замера, чтобы грязные страницы
+// одного прогона не дописывались во время следующего
+static void drop_outputs(char** OUT_paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int fd = open(OUT_paths[i], O_WRONLY);
+        if (fd >= 0) {
+            fdatasync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+        unlink(OUT_paths[i]);
+    }
+}
+
+// COPY_FALLBACK - способ не подходит для этих файлов (например, O_DIRECT на tmpfs):
+// это не ошибка, а unsupported
+static const char* status_name(enum copy_status_t status) {
+    switch (status) {
+        case COPY_DONE:     return "ok";
+        case COPY_FALLBACK: return "unsupported";
+        default:            return "failed";
+    }
+}
+
+static void print_row(const struct bench_input_t* input, bool hot, const char* strategy,
+                      size_t buffer_size, const struct bench_sample_t* sample, enum copy_status_t status) {
+    double mb = input->total_bytes / (double)(1 << 20);
+    printf("%s,%s,%s,%zu,%lld,%.6f,%.1f,%.2f,%.6f,%.6f,%s\n",
+           input->name, hot ? "hot" : "cold", strategy, buffer_size, (long long)input->total_bytes,
+           sample->seconds, sample->seconds > 0 ? mb / sample->seconds : 0,
+           mb > 0 ? sample->syscalls / mb : 0, sample->user_s, sample->sys_s, status_name(status));
+    fflush(stdout);
+}
+
+static void bench_fd_strategy(const struct bench_input_t* input, char** OUT_paths, bool hot,
+                              const struct bench_strategy_t* strategy) {
+    prepare_cache(input, hot);
+
+    // ошибка хоть на одном файле важнее неподдерживаемого способа
+    enum copy_status_t status = COPY_DONE;
+    struct bench_sample_t sample;
+    sample_begin(&sample);
+    for (size_t i = 0; i < input->count; i++) {
+        int fd_IN  = open(input->paths[i], O_RDONLY);
+        int fd_OUT = open(OUT_paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        struct stat st;
+        enum copy_status_t file_status = COPY_FAILED;
+        if (fd_IN >= 0 && fd_OUT >= 0 && fstat(fd_IN, &st) == 0) {
+            file_status = strategy->run(fd_IN, fd_OUT, st.st_size, strategy->buffer_size);
+        }
+        if (file_status == COPY_FAILED || status == COPY_DONE) {
+            status = status == COPY_FAILED ? COPY_FAILED : file_status;
+        }
+        if (fd_IN >= 0) {
+            close(fd_IN);
+        }
+        if (fd_OUT >= 0) {
+            close(fd_OUT);
+        }
+    }
+    sample_end(&sample);
+
+    print_row(input, hot, strategy->name, strategy->buffer_size, &sample, status);
+    drop_outputs(OUT_paths, input->count);
+}
+
+static void bench_uring(const struct bench_input_t* input, char** OUT_paths, bool hot) {
+    prepare_cache(input, hot);
+
+    struct flags_states flags = {.uring = true, .queue_depth = URING_DEFAULT_DEPTH};
+    struct bench_sample_t sample;
+    unsigned long long uring_before = uring_syscall_count();
+    sample_begin(&sample);
+    enum copy_status_t status = copy_files_uring((const char* const*)input->paths, (const char* const*)OUT_paths,
+                                                 input->count, O_WRONLY | O_CREAT | O_TRUNC, &flags);
+    sample_end(&sample);
+    sample.syscalls += uring_syscall_count() - uring_before;
+
+    print_row(input, hot, "io_uring", URING_BUFFER_SIZE, &sample, status);
+    drop_outputs(OUT_paths, input->count);
+}
+
+static void bench_input(const struct bench_input_t* input, const char* dir) {
+    char** OUT_paths = calloc(input->count, sizeof(*OUT_paths));
+    if (OUT_paths == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < input->count; i++) {
+        OUT_paths[i] = make_path(dir, "copy", i);
+    }
+
+    for (int hot = 0; hot <= 1; hot++) {
+        for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+            bench_fd_strategy(input, OUT_paths, hot, &strategies[i]);
+        }
+        bench_uring(input, OUT_paths, hot);
+    }
+
+    for (size_t i = 0; i < input->count; i++) {
+        free(OUT_paths[i]);
+    }
+    free(OUT_paths);
+}
+
+int main(int argc, char* argv[]) {
+    size_t size_mb     = 1024;
+    size_t tiny_count  = 1000;
+    const char* dir    = "bench_data";
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:n:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (! parse_positive(optarg, &size_mb)) {
+                    fprintf(stderr, "ERROR: -s expects size in MB, got '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'n':
+                if (! parse_positive(optarg, &tiny_count)) {
+                    fprintf(stderr, "ERROR: -n expects a positive number, got '%s'\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s SIZE_MB] [-n TINY_COUNT] [-d DIR]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("Error while creating bench directory");
+        return -1;
+    }
+
+    off_t big_size = (off_t)size_mb << 20;
+    struct bench_input_t inputs[3] = {};
+    bool ready = make_input(&inputs[0], dir, "tiny",   tiny_count, BENCH_TINY_SIZE, false) &&
+                 make_input(&inputs[1], dir, "dense",  1,          big_size,        false) &&
+                 make_input(&inputs[2], dir, "sparse", 1,          big_size,        true);
+
+    if (ready) {
+        printf("input,cache,strategy,buffer,bytes,seconds,mb_per_s,syscalls_per_mb,user_s,sys_s,status\n");
+        for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+            bench_input(&inputs[i], dir);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        free_input(&inputs[i]);
+    }
+    rmdir(dir);
+    return ready ? 0 : -1;
+}
@@ -1,4 +1,6 @@
 
+#include <stdlib.h>
+
 #include "mycp.h"
 
 int main(int argc, char* argv[]) {
@@ -9,32 +11,43 @@ int main(int argc, char* argv[]) {
     if (flags.interactive && get_interactive_permission()) {
         flags.force = true;
     }
-    size_t arguments_counter = 1 + flags.verbose_count + flags.interactive_count + flags.force_count;
+    // getopt_long переставляет аргументы так, что все пути оказываются после optind
+    size_t arguments_counter = optind;
 
     int open_flags = combine_open_flags(&flags);
+    int copy_res = 0;
     if (is_dir(argv[argc-1])) {
-        char dest_dir[BUFSIZ / 2];
+        char dest_dir[BUFSIZ / 2] = {};
         strncpy(dest_dir, argv[argc-1], strlen(argv[argc-1]));
 
-        for (int file_ind = arguments_counter; file_ind < argc - 1; file_ind++) {
+        size_t files_count = argc - 1 - arguments_counter;
+        const char** IN_paths  = calloc(files_count + 1, sizeof(*IN_paths));
+        char** OUT_paths       = calloc(files_count + 1, sizeof(*OUT_paths));
+        if (IN_paths == NULL || OUT_paths == NULL) {
+            perror("Error in calloc");
+            free(IN_paths);
+            free(OUT_paths);
+            return -1;
+        }
+        for (size_t i = 0; i < files_count; i++) {
             char dest_file_path[BUFSIZ] = {};
-            snprintf(dest_file_path, BUFSIZ, "./%s/%s", dest_dir, argv[file_ind]);
+            snprintf(dest_file_path, BUFSIZ, "./%s/%s", dest_dir, argv[arguments_counter + i]);
 
-            const char* IN_path  = argv[file_ind];
-            const char* OUT_path = dest_file_path;
-            int pstream_res = pstream(IN_path, OUT_path, open_flags);
-            if (flags.verbose && pstream_res == 0) {
-                printf("\'%s\' -> \'%s\'\n", IN_path, OUT_path);
-            }
+            IN_paths[i]  = argv[arguments_counter + i];
+            OUT_paths[i] = strdup(dest_file_path);
         }
+        copy_res = copy_files(IN_paths, (const char* const*)OUT_paths, files_count, open_flags, &flags);
+
+        for (size_t i = 0; i < files_count; i++) {
+            free(OUT_paths[i]);
+        }
+        free(IN_paths);
+        free(OUT_paths);
     } else {
         size_t curr_arg_ind = arguments_counter;
         const char* IN_path  = argv[curr_arg_ind];
         const char* OUT_path = argv[curr_arg_ind + 1];
-        int pstream_res = pstream(IN_path, OUT_path, open_flags);
-        if (flags.verbose && pstream_res == 0) {
-            printf("\'%s\' -> \'%s\'\n", IN_path, OUT_path);
-        }
+        copy_res = copy_path(IN_path, OUT_path, open_flags, &flags);
     }
-    return 0;
+    return copy_res == 0 ? 0 : 1;
 }
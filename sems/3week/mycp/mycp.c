@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -5,6 +7,7 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <assert.h>
+#include <sys/sendfile.h>
 
 #include "mycp.h"
 
@@ -13,18 +16,81 @@ void clean_input_buffer() {
         continue;
 }
 
+bool parse_positive(const char* arg, size_t* value) {
+    assert(arg);
+    assert(value);
+
+    char* end = NULL;
+    long parsed = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed < 1) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Число байт с необязательным суффиксом K, M или G (степени 1024)
+bool parse_size(const char* arg, size_t* value) {
+    assert(arg);
+    assert(value);
+
+    char* end = NULL;
+    long long parsed = strtoll(arg, &end, 10);
+    if (*arg == '\0' || end == arg || parsed < 1) {
+        return false;
+    }
+    switch (*end) {
+        case '\0':                  break;
+        case 'K': case 'k':         parsed <<= 10; end++; break;
+        case 'M': case 'm':         parsed <<= 20; end++; break;
+        case 'G': case 'g':         parsed <<= 30; end++; break;
+        default:                    return false;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+bool parse_sparse_mode(const char* arg, enum sparse_mode_t* mode) {
+    assert(arg);
+    assert(mode);
+
+    if (strcmp(arg, "auto") == 0) {
+        *mode = SPARSE_AUTO;
+    } else if (strcmp(arg, "always") == 0) {
+        *mode = SPARSE_ALWAYS;
+    } else if (strcmp(arg, "never") == 0) {
+        *mode = SPARSE_NEVER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 bool check_flags(struct flags_states* flags_values, int argc, char *const argv[])
 {
     assert(flags_values != NULL);
     assert(argv != NULL);
 
+    flags_values->queue_depth = URING_DEFAULT_DEPTH;
+
     int opt = 0;
-    const char optstring[] = "vif";
+    const char optstring[] = "vifrj:b:";
     struct option longoptions[] =
     {
         {"verbose",     0, 0, 'v'},
         {"interactive", 0, 0, 'i'},
-        {"force",       0, 0, 'f'}
+        {"force",       0, 0, 'f'},
+        {"sparse",      1, 0, OPT_SPARSE},
+        {"recursive",   0, 0, 'r'},
+        {"jobs",        1, 0, 'j'},
+        {"buffer-size", 1, 0, 'b'},
+        {"direct",      0, 0, OPT_DIRECT},
+        {"uring",       0, 0, OPT_URING},
+        {"queue-depth", 1, 0, OPT_QUEUE_DEPTH},
+        {0,             0, 0, 0}
     };
     int optidx = 0;
 
@@ -44,6 +110,39 @@ bool check_flags(struct flags_states* flags_values, int argc, char *const argv[]
                 flags_values->force = true;
                 flags_values->force_count += 1;
                 break;
+            case 'r':
+                flags_values->recursive = true;
+                break;
+            case 'j':
+                if (! parse_positive(optarg, &flags_values->jobs)) {
+                    fprintf(stderr, "ERROR: --jobs expects a positive number, got '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'b':
+                if (! parse_size(optarg, &flags_values->buffer_size)) {
+                    fprintf(stderr, "ERROR: --buffer-size expects a size like 65536, 64K or 1M, got '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_DIRECT:
+                flags_values->direct = true;
+                break;
+            case OPT_URING:
+                flags_values->uring = true;
+                break;
+            case OPT_QUEUE_DEPTH:
+                if (! parse_positive(optarg, &flags_values->queue_depth) || flags_values->queue_depth < 2) {
+                    fprintf(stderr, "ERROR: --queue-depth expects a number >= 2, got '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case OPT_SPARSE:
+                if (! parse_sparse_mode(optarg, &flags_values->sparse)) {
+                    fprintf(stderr, "ERROR: --sparse expects always, auto or never, got '%s'\n", optarg);
+                    return false;
+                }
+                break;
 
             default:
                 fprintf(stderr, "option read error\n");
@@ -105,7 +204,10 @@ ssize_t safewrite(int fd, const void* buffer, size_t size) {
     ssize_t written_total = 0;
     while ((size_t)written_total < size) {
         ssize_t written_on_write = write(fd, buffer + written_total, size - written_total);
-        if (written_on_write < 0 && errno != EINTR) {
+        if (written_on_write < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             perror("Error in safe write");
             return written_on_write;
         }
@@ -114,48 +216,408 @@ ssize_t safewrite(int fd, const void* buffer, size_t size) {
     return written_total;
 }
 
-void stream(int fd_IN, int fd_OUT) {
+// Запасной путь для всех способов копирования, поэтому ошибки не глотаются:
+// safewrite сам сообщает о своей, здесь остается только вернуть COPY_FAILED
+enum copy_status_t stream(int fd_IN, int fd_OUT, size_t buffer_size) {
 
-    char buffer[BUFSIZ];
-    ssize_t bytes_read    = -1;
-    ssize_t bytes_written = 0;
+    char* buffer = malloc(buffer_size);
+    if (buffer == NULL) {
+        perror("Error in malloc");
+        return COPY_FAILED;
+    }
+    enum copy_status_t status = COPY_DONE;
+    ssize_t bytes_read = -1;
 
     while (bytes_read != 0) {
-        bytes_read = read(fd_IN, buffer, BUFSIZ);
+        bytes_read = read(fd_IN, buffer, buffer_size);
         if (bytes_read < 0) {
             if (errno == EINTR) {
                 continue;
             } else {
                 perror("Error on read: ");
+                status = COPY_FAILED;
+                break;
+            }
+        }
+        if (safewrite(fd_OUT, buffer, bytes_read) < 0) {
+            status = COPY_FAILED;
+            break;
+        }
+    }
+    free(buffer);
+    return status;
+}
+
+// Явный --buffer-size побеждает. Иначе берем размер файла (маленькие файлы читаются
+// за один вызов), но не меньше st_blksize и не больше STREAM_MAX_BUFFER,
+// и округляем вверх до st_blksize, чтобы не дробить блоки файловой системы
+size_t choose_buffer_size(const struct stat* st_IN, const struct stat* st_OUT, size_t requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    size_t block = BUFSIZ;
+    if (st_IN != NULL && (size_t)st_IN->st_blksize > block) {
+        block = st_IN->st_blksize;
+    }
+    if (st_OUT != NULL && (size_t)st_OUT->st_blksize > block) {
+        block = st_OUT->st_blksize;
+    }
+
+    size_t want = STREAM_MAX_BUFFER;
+    if (st_IN != NULL && S_ISREG(st_IN->st_mode) && st_IN->st_size > 0 &&
+        (size_t)st_IN->st_size < STREAM_MAX_BUFFER) {
+        want = st_IN->st_size;
+    }
+    if (want < block) {
+        want = block;
+    }
+    return (want + block - 1) / block * block;
+}
+
+static bool set_direct(int fd, bool enable) {
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0) {
+        return false;
+    }
+    fl = enable ? (fl | O_DIRECT) : (fl & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, fl) == 0;
+}
+
+// Копия мимо page cache. Буфер выровнен на страницу и кратен ей, поэтому
+// все чтения и записи, кроме последнего неполного блока, идут с O_DIRECT.
+// Хвост пишется уже без O_DIRECT и сразу выкидывается из кэша
+enum copy_status_t copy_direct(int fd_IN, int fd_OUT, size_t buffer_size) {
+    size_t align = sysconf(_SC_PAGESIZE);
+    buffer_size  = (buffer_size + align - 1) / align * align;
+
+    // tmpfs и часть сетевых ФС не умеют O_DIRECT - об этом скажет fcntl
+    if (! set_direct(fd_IN, true) || ! set_direct(fd_OUT, true)) {
+        set_direct(fd_IN, false);
+        return COPY_FALLBACK;
+    }
+    char* buffer = NULL;
+    if (posix_memalign((void**)&buffer, align, buffer_size) != 0) {
+        // stream() обойдется обычным буфером, но только без O_DIRECT
+        perror("Error in posix_memalign");
+        set_direct(fd_IN, false);
+        set_direct(fd_OUT, false);
+        return COPY_FALLBACK;
+    }
+
+    enum copy_status_t status = COPY_DONE;
+    off_t offset = 0;
+    while (true) {
+        ssize_t bytes_read = read(fd_IN, buffer, buffer_size);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error on read");
+            status = COPY_FAILED;
+            break;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        if (bytes_read % align != 0) {
+            // неполный блок бывает только в конце файла
+            set_direct(fd_OUT, false);
+            if (safewrite(fd_OUT, buffer, bytes_read) < 0 || fdatasync(fd_OUT) < 0) {
+                status = COPY_FAILED;
+                break;
+            }
+            posix_fadvise(fd_OUT, offset, bytes_read, POSIX_FADV_DONTNEED);
+            break;
+        }
+        if (safewrite(fd_OUT, buffer, bytes_read) < 0) {
+            status = COPY_FAILED;
+            break;
+        }
+        offset += bytes_read;
+    }
+    free(buffer);
+    return status;
+}
+
+// Для --direct там, где O_DIRECT недоступен: после обычной копии просим ядро забыть страницы
+static void drop_page_cache(int fd_IN, int fd_OUT) {
+    fdatasync(fd_OUT);
+    posix_fadvise(fd_IN, 0, 0, POSIX_FADV_DONTNEED);
+    posix_fadvise(fd_OUT, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+const char* copy_engine_name(enum copy_engine_t engine) {
+    switch (engine) {
+        case ENGINE_URING:              return "io_uring";
+        case ENGINE_DIRECT:             return "O_DIRECT";
+        case ENGINE_SPARSE:             return "sparse (SEEK_DATA/SEEK_HOLE)";
+        case ENGINE_PARALLEL:           return "parallel chunks";
+        case ENGINE_COPY_FILE_RANGE:    return "copy_file_range";
+        case ENGINE_SENDFILE:           return "sendfile";
+        case ENGINE_STREAM:             return "read/write";
+        default:                        return "unknown";
+    }
+}
+
+// ядро не умеет копировать между этими fd - надо пробовать следующий способ
+static bool is_fallback_errno(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF;
+}
+
+enum copy_status_t copy_with_file_range(int fd_IN, int fd_OUT, off_t size) {
+    if (size == 0) {
+        // размер 0 бывает и у псевдофайлов /proc с данными, поэтому пустоту проверяем чтением
+        char byte;
+        if (pread(fd_IN, &byte, 1, 0) == 0) {
+            return COPY_DONE;
+        }
+    }
+
+    off_t copied_total = 0;
+    while (true) {
+        ssize_t copied = copy_file_range(fd_IN, NULL, fd_OUT, NULL, KERNEL_COPY_CHUNK, 0);
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (is_fallback_errno(errno)) {
+                return COPY_FALLBACK;
+            }
+            perror("Error in copy_file_range");
+            return COPY_FAILED;
+        }
+        if (copied == 0) {
+            // псевдофайлы (например, /proc) отдают 0 сразу, хотя данные есть
+            if (copied_total == 0 || copied_total < size) {
+                return COPY_FALLBACK;
+            }
+            return COPY_DONE;
+        }
+        copied_total += copied;
+    }
+}
+
+enum copy_status_t copy_with_sendfile(int fd_IN, int fd_OUT) {
+    while (true) {
+        ssize_t copied = sendfile(fd_OUT, fd_IN, NULL, KERNEL_COPY_CHUNK);
+        if (copied < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (is_fallback_errno(errno)) {
+                return COPY_FALLBACK;
+            }
+            perror("Error in sendfile");
+            return COPY_FAILED;
+        }
+        if (copied == 0) {
+            return COPY_DONE;
+        }
+    }
+}
+
+// st_blocks считается в 512-байтных единицах независимо от st_blksize
+bool is_sparse_file(const struct stat* st) {
+    assert(st);
+    return S_ISREG(st->st_mode) && (off_t)st->st_blocks * 512 < st->st_size;
+}
+
+bool is_zero_block(const char* buffer, size_t size) {
+    assert(buffer);
+    return size == 0 || (buffer[0] == 0 && memcmp(buffer, buffer + 1, size - 1) == 0);
+}
+
+// Копирует [offset, offset + length) по явным смещениям, не трогая позиции файлов.
+// С punch_zeroes блоки из нулей не пишутся, а пропускаются - на их месте остаются дыры
+enum copy_status_t copy_data_range(int fd_IN, int fd_OUT, off_t offset, off_t length, bool punch_zeroes) {
+    off_t end = offset + length;
+
+    if (! punch_zeroes) {
+        off_t off_IN  = offset;
+        off_t off_OUT = offset;
+        while (off_IN < end) {
+            ssize_t copied = copy_file_range(fd_IN, &off_IN, fd_OUT, &off_OUT, end - off_IN, 0);
+            if (copied < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (is_fallback_errno(errno)) {
+                    break;
+                }
+                perror("Error in copy_file_range");
+                return COPY_FAILED;
+            }
+            if (copied == 0) {
                 break;
             }
         }
-        bytes_written = safewrite(fd_OUT, buffer, bytes_read);
-        if (bytes_written < 0 && errno != EINTR) {
-            perror("Error in write: ");
+        offset = off_IN;
+    }
+
+    char buffer[BUFSIZ];
+    while (offset < end) {
+        size_t to_read = (end - offset < BUFSIZ) ? (size_t)(end - offset) : BUFSIZ;
+        ssize_t bytes_read = pread(fd_IN, buffer, to_read, offset);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error on pread");
+            return COPY_FAILED;
+        }
+        if (bytes_read == 0) {
             break;
         }
+        if (! (punch_zeroes && is_zero_block(buffer, bytes_read))) {
+            ssize_t written_total = 0;
+            while (written_total < bytes_read) {
+                ssize_t written = pwrite(fd_OUT, buffer + written_total, bytes_read - written_total,
+                                         offset + written_total);
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    perror("Error in pwrite");
+                    return COPY_FAILED;
+                }
+                written_total += written;
+            }
+        }
+        offset += bytes_read;
     }
+    return COPY_DONE;
 }
 
-int pstream(const char* IN_path, const char* OUT_path, int open_flags) {
+// Обходит экстенты данных источника и копирует только их; дыры в приемнике
+// появляются сами, а хвостовую дыру и итоговый размер выставляет ftruncate
+enum copy_status_t copy_sparse(int fd_IN, int fd_OUT, off_t size, bool punch_zeroes) {
+    off_t data = 0;
+    while (data < size) {
+        data = lseek(fd_IN, data, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                break;      // дальше до конца файла только дыра
+            }
+            if (errno == EINVAL || errno == ENOTSUP) {
+                return COPY_FALLBACK;
+            }
+            perror("Error in lseek(SEEK_DATA)");
+            return COPY_FAILED;
+        }
+        off_t hole = lseek(fd_IN, data, SEEK_HOLE);
+        if (hole < 0) {
+            perror("Error in lseek(SEEK_HOLE)");
+            return COPY_FAILED;
+        }
+        if (hole > size) {
+            hole = size;
+        }
+
+        if (copy_data_range(fd_IN, fd_OUT, data, hole - data, punch_zeroes) != COPY_DONE) {
+            return COPY_FAILED;
+        }
+        data = hole;
+    }
+
+    if (ftruncate(fd_OUT, size) < 0) {
+        perror("Error in ftruncate");
+        return COPY_FAILED;
+    }
+    return COPY_DONE;
+}
+
+// Оба системных вызова двигают файловые смещения так же, как read/write,
+// поэтому переключаться на следующий способ можно даже после частичного копирования
+int copy_engine(int fd_IN, int fd_OUT, struct flags_states* flags, enum copy_engine_t* used_engine) {
+    assert(flags);
+    assert(used_engine);
+
+    struct stat st_IN;
+    struct stat st_OUT;
+    bool stat_IN     = fstat(fd_IN, &st_IN) == 0;
+    bool stat_OUT    = fstat(fd_OUT, &st_OUT) == 0;
+    bool regular_IN  = stat_IN && S_ISREG(st_IN.st_mode);
+    bool regular_OUT = stat_OUT && S_ISREG(st_OUT.st_mode);
+    size_t buffer_size = choose_buffer_size(stat_IN ? &st_IN : NULL, stat_OUT ? &st_OUT : NULL,
+                                            flags->buffer_size);
+
+    if (flags->direct) {
+        if (regular_IN && regular_OUT) {
+            *used_engine = ENGINE_DIRECT;
+            enum copy_status_t status = copy_direct(fd_IN, fd_OUT, buffer_size);
+            if (status != COPY_FALLBACK) {
+                return status;
+            }
+        }
+        *used_engine = ENGINE_STREAM;
+        enum copy_status_t status = stream(fd_IN, fd_OUT, buffer_size);
+        drop_page_cache(fd_IN, fd_OUT);
+        return status;
+    }
+
+    if (regular_IN) {
+        bool want_sparse = flags->sparse == SPARSE_ALWAYS ||
+                          (flags->sparse == SPARSE_AUTO && is_sparse_file(&st_IN));
+        if (regular_OUT && want_sparse) {
+            *used_engine = ENGINE_SPARSE;
+            enum copy_status_t status = copy_sparse(fd_IN, fd_OUT, st_IN.st_size,
+                                                    flags->sparse == SPARSE_ALWAYS);
+            if (status != COPY_FALLBACK) {
+                return status;
+            }
+        }
+
+        if (regular_OUT && flags->jobs > 1 && st_IN.st_size >= PARALLEL_MIN_SIZE) {
+            *used_engine = ENGINE_PARALLEL;
+            enum copy_status_t status = copy_parallel(fd_IN, fd_OUT, st_IN.st_size, flags);
+            if (status != COPY_FALLBACK) {
+                return status;
+            }
+        }
+
+        *used_engine = ENGINE_COPY_FILE_RANGE;
+        enum copy_status_t status = copy_with_file_range(fd_IN, fd_OUT, st_IN.st_size);
+        if (status != COPY_FALLBACK) {
+            return status;
+        }
+
+        *used_engine = ENGINE_SENDFILE;
+        status = copy_with_sendfile(fd_IN, fd_OUT);
+        if (status != COPY_FALLBACK) {
+            return status;
+        }
+    }
+
+    *used_engine = ENGINE_STREAM;
+    return stream(fd_IN, fd_OUT, buffer_size);
+}
+
+// пути считаются относительно dirfd_IN/dirfd_OUT, как у openat
+int pstreamat(int dirfd_IN, const char* IN_path, int dirfd_OUT, const char* OUT_path,
+              int open_flags, struct flags_states* flags) {
     assert(IN_path);
     assert(OUT_path);
+    assert(flags);
 
-    int fd_IN  = open(IN_path, O_RDONLY);
+    int fd_IN  = openat(dirfd_IN, IN_path, O_RDONLY);
     if (fd_IN < 0) {
         printf("file name: [%s]\n", IN_path);
         perror("Error while opening file in O_RDONLY mode: %s\n");
         return -1;
     }
-    int fd_OUT = open(OUT_path, open_flags, 0666);
+    int fd_OUT = openat(dirfd_OUT, OUT_path, open_flags, 0666);
     if (fd_OUT < 0) {
         printf("file name: [%s]\n", OUT_path);
         perror("Error while opening file: ");
+        close(fd_IN);
         return -1;
     }
 
-    stream(fd_IN, fd_OUT);
+    enum copy_engine_t used_engine = ENGINE_STREAM;
+    int copy_res = copy_engine(fd_IN, fd_OUT, flags, &used_engine);
+    if (flags->verbose) {
+        printf("copy engine: %s\n", copy_engine_name(used_engine));
+    }
 
     int close_res = close(fd_IN);
     if (close_res < 0) {
@@ -167,5 +629,57 @@ int pstream(const char* IN_path, const char* OUT_path, int open_flags) {
         perror("Error while closing file: ");
         // continue;
     }
-    return 0;
+    return copy_res;
+}
+
+int pstream(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags) {
+    return pstreamat(AT_FDCWD, IN_path, AT_FDCWD, OUT_path, open_flags, flags);
+}
+
+// Единая точка входа для одного аргумента: каталоги уходят в copy_tree, файлы в pstream
+int copy_path(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags) {
+    assert(IN_path);
+    assert(OUT_path);
+    assert(flags);
+
+    if (is_dir(IN_path)) {
+        if (! flags->recursive) {
+            fprintf(stderr, "mycp: -r not specified; omitting directory '%s'\n", IN_path);
+            return -1;
+        }
+        return copy_tree(IN_path, OUT_path, open_flags, flags);
+    }
+    int pstream_res = pstream(IN_path, OUT_path, open_flags, flags);
+    if (flags->verbose && pstream_res == 0) {
+        printf("\'%s\' -> \'%s\'\n", IN_path, OUT_path);
+    }
+    return pstream_res;
+}
+
+// Пачка независимых копий. С --uring все файлы идут через одно кольцо io_uring,
+// а если ядро его не поддерживает - по одному через copy_path
+int copy_files(const char* const* IN_paths, const char* const* OUT_paths, size_t count,
+               int open_flags, struct flags_states* flags) {
+    assert(IN_paths);
+    assert(OUT_paths);
+    assert(flags);
+
+    // каталоги копирует copy_tree со своим пулом потоков, кольцу они не достаются
+    if (flags->uring && ! flags->recursive) {
+        enum copy_status_t status = copy_files_uring(IN_paths, OUT_paths, count, open_flags, flags);
+        if (status != COPY_FALLBACK) {
+            return status;
+        }
+        if (flags->verbose) {
+            printf("io_uring is not available, copying files one by one\n");
+        }
+    }
+
+    int res = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (copy_path(IN_paths[i], OUT_paths[i], open_flags, flags) != 0) {
+            res = -1;
+        }
+    }
+    return res;
 }
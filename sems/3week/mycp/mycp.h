@@ -10,11 +10,70 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
+// верхняя граница автоматически подобранного буфера для stream()
+#define STREAM_MAX_BUFFER       (1UL << 20)
+
+// сколько байт просим у ядра за один вызов copy_file_range/sendfile
+#define KERNEL_COPY_CHUNK (1UL << 30)
+
+// параметры --jobs: файлы меньше PARALLEL_MIN_SIZE копируем в один поток
+#define PARALLEL_MIN_SIZE       ((off_t)64 << 20)
+#define PARALLEL_MIN_CHUNK      ((off_t)1 << 20)
+#define PARALLEL_MAX_CHUNK      ((off_t)64 << 20)
+#define PARALLEL_CHUNKS_PER_JOB 4
+
+// сколько файлов обходчик каталогов может держать в очереди к копирующим потокам
+#define TREE_QUEUE_SIZE         1024
+// дескрипторы, которые обход дерева не отдает под открытые пары каталогов
+#define TREE_RESERVED_FDS       16
+
+// --uring: глубина очереди по умолчанию и размер зарегистрированного буфера на файл
+#define URING_DEFAULT_DEPTH     32
+#define URING_BUFFER_SIZE       (128 * 1024)
+
+// насколько настойчиво сохраняем дыры в приемнике (как cp --sparse=WHEN)
+enum sparse_mode_t {
+    SPARSE_AUTO,        // обходим экстенты, только если источник похож на разреженный
+    SPARSE_ALWAYS,      // обходим экстенты и превращаем нулевые блоки данных в дыры
+    SPARSE_NEVER,       // пишем файл целиком, дыры читаются как нули
+};
+
+// коды для длинных опций без короткого аналога
+enum long_only_option_t {
+    OPT_SPARSE = 256,
+    OPT_DIRECT,
+    OPT_URING,
+    OPT_QUEUE_DEPTH,
+};
+
+enum copy_engine_t {
+    ENGINE_URING,
+    ENGINE_DIRECT,
+    ENGINE_SPARSE,
+    ENGINE_PARALLEL,
+    ENGINE_COPY_FILE_RANGE,
+    ENGINE_SENDFILE,
+    ENGINE_STREAM,
+};
+
+enum copy_status_t {
+    COPY_FAILED   = -1,
+    COPY_DONE     =  0,
+    COPY_FALLBACK =  1,
+};
+
 struct flags_states
 {
     bool verbose;
     bool interactive;
     bool force;
+    bool recursive;
+    enum sparse_mode_t sparse;
+    size_t jobs;
+    size_t buffer_size;         // 0 - подобрать по st_blksize и размеру файла
+    bool direct;
+    bool uring;
+    size_t queue_depth;
 
     size_t verbose_count;
     size_t interactive_count;
@@ -23,6 +82,9 @@ struct flags_states
 
 void clean_input_buffer();
 
+bool parse_positive(const char* arg, size_t* value);
+bool parse_size(const char* arg, size_t* value);
+bool parse_sparse_mode(const char* arg, enum sparse_mode_t* mode);
 bool check_flags(struct flags_states *flags_values, int argc, char *const argv[]);
 void print_choose_option();
 bool get_interactive_permission();
@@ -32,5 +94,29 @@ int combine_open_flags(struct flags_states* flags);
 int is_dir(const char *path);
 
 ssize_t safewrite(int fd, const void* buffer, size_t size);
-void stream(int fd_IN, int fd_OUT);
-int pstream(const char* IN_path, const char* OUT_path, int open_flags);
+enum copy_status_t stream(int fd_IN, int fd_OUT, size_t buffer_size);
+size_t choose_buffer_size(const struct stat* st_IN, const struct stat* st_OUT, size_t requested);
+enum copy_status_t copy_direct(int fd_IN, int fd_OUT, size_t buffer_size);
+
+const char* copy_engine_name(enum copy_engine_t engine);
+enum copy_status_t copy_with_file_range(int fd_IN, int fd_OUT, off_t size);
+enum copy_status_t copy_with_sendfile(int fd_IN, int fd_OUT);
+bool is_sparse_file(const struct stat* st);
+bool is_zero_block(const char* buffer, size_t size);
+enum copy_status_t copy_data_range(int fd_IN, int fd_OUT, off_t offset, off_t length, bool punch_zeroes);
+enum copy_status_t copy_sparse(int fd_IN, int fd_OUT, off_t size, bool punch_zeroes);
+off_t choose_chunk_size(off_t size, size_t jobs);
+enum copy_status_t copy_parallel(int fd_IN, int fd_OUT, off_t size, struct flags_states* flags);
+int copy_engine(int fd_IN, int fd_OUT, struct flags_states* flags, enum copy_engine_t* used_engine);
+int pstreamat(int dirfd_IN, const char* IN_path, int dirfd_OUT, const char* OUT_path,
+              int open_flags, struct flags_states* flags);
+int pstream(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags);
+
+int copy_tree(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags);
+int copy_path(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags);
+
+enum copy_status_t copy_files_uring(const char* const* IN_paths, const char* const* OUT_paths, size_t count,
+                                    int open_flags, struct flags_states* flags);
+unsigned long long uring_syscall_count();
+int copy_files(const char* const* IN_paths, const char* const* OUT_paths, size_t count,
+               int open_flags, struct flags_states* flags);
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mycp.h"
+
+struct parallel_copy_t {
+    int fd_IN;
+    int fd_OUT;
+    off_t size;
+    off_t chunk_size;
+    size_t chunks_count;
+
+    atomic_size_t next_chunk;
+    atomic_bool failed;
+};
+
+struct worker_stats_t {
+    struct parallel_copy_t* job;
+    size_t bytes;
+    size_t chunks;
+    double seconds;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Примерно по PARALLEL_CHUNKS_PER_JOB кусков на поток, чтобы быстрые потоки
+// могли забрать работу у медленных, но без мелких кусков на каждый syscall
+off_t choose_chunk_size(off_t size, size_t jobs) {
+    assert(jobs > 0);
+
+    off_t chunk_size = size / (off_t)(jobs * PARALLEL_CHUNKS_PER_JOB);
+    if (chunk_size < PARALLEL_MIN_CHUNK) {
+        chunk_size = PARALLEL_MIN_CHUNK;
+    }
+    if (chunk_size > PARALLEL_MAX_CHUNK) {
+        chunk_size = PARALLEL_MAX_CHUNK;
+    }
+    // выравниваем на минимальный кусок, чтобы границы попадали на границы страниц
+    return chunk_size / PARALLEL_MIN_CHUNK * PARALLEL_MIN_CHUNK;
+}
+
+// Куски раздаются через общий счетчик, поэтому поток, закончивший раньше, берет следующий
+static void* copy_worker(void* arg) {
+    struct worker_stats_t* stats = arg;
+    struct parallel_copy_t* job  = stats->job;
+
+    double start = now_seconds();
+    while (! atomic_load(&job->failed)) {
+        size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->chunks_count) {
+            break;
+        }
+        off_t offset = (off_t)chunk * job->chunk_size;
+        off_t length = job->size - offset < job->chunk_size ? job->size - offset : job->chunk_size;
+
+        if (copy_data_range(job->fd_IN, job->fd_OUT, offset, length, false) != COPY_DONE) {
+            atomic_store(&job->failed, true);
+            break;
+        }
+        stats->bytes  += length;
+        stats->chunks += 1;
+    }
+    stats->seconds = now_seconds() - start;
+    return NULL;
+}
+
+static void print_worker_stats(const struct worker_stats_t* stats, size_t jobs) {
+    for (size_t i = 0; i < jobs; i++) {
+        double mb_per_sec = stats[i].seconds > 0 ? stats[i].bytes / stats[i].seconds / (1 << 20) : 0;
+        printf("thread %zu: %zu chunks, %zu bytes in %.3f s (%.1f MB/s)\n",
+               i, stats[i].chunks, stats[i].bytes, stats[i].seconds, mb_per_sec);
+    }
+}
+
+enum copy_status_t copy_parallel(int fd_IN, int fd_OUT, off_t size, struct flags_states* flags) {
+    assert(flags);
+    assert(flags->jobs > 1);
+
+    // место под весь файл сразу: потоки пишут в разные места, и без этого
+    // файловая система выделяет экстенты вразнобой
+    int alloc_res = fallocate(fd_OUT, 0, 0, size);
+    if (alloc_res < 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        perror("Error in fallocate");
+        return COPY_FAILED;
+    }
+    if (alloc_res < 0 && ftruncate(fd_OUT, size) < 0) {
+        perror("Error in ftruncate");
+        return COPY_FAILED;
+    }
+
+    struct parallel_copy_t job = {
+        .fd_IN        = fd_IN,
+        .fd_OUT       = fd_OUT,
+        .size         = size,
+        .chunk_size   = choose_chunk_size(size, flags->jobs),
+    };
+    job.chunks_count = (size + job.chunk_size - 1) / job.chunk_size;
+    atomic_init(&job.next_chunk, 0);
+    atomic_init(&job.failed, false);
+
+    size_t jobs = flags->jobs < job.chunks_count ? flags->jobs : job.chunks_count;
+    pthread_t* threads           = calloc(jobs, sizeof(*threads));
+    struct worker_stats_t* stats = calloc(jobs, sizeof(*stats));
+    if (threads == NULL || stats == NULL) {
+        perror("Error in calloc");
+        free(threads);
+        free(stats);
+        return COPY_FAILED;
+    }
+
+    size_t started = 0;
+    for (; started < jobs; started++) {
+        stats[started].job = &job;
+        int create_res = pthread_create(&threads[started], NULL, copy_worker, &stats[started]);
+        if (create_res != 0) {
+            errno = create_res;
+            perror("Error in pthread_create");
+            break;
+        }
+    }
+    // если часть потоков не создалась, оставшиеся просто разберут все куски сами;
+    // если ни одного - файл копирует следующий способ из copy_engine поверх выделенного места
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (flags->verbose_count >= 2) {
+        printf("parallel copy: %zu threads, chunk size %lld bytes\n", started, (long long)job.chunk_size);
+        print_worker_stats(stats, started);
+    }
+
+    free(threads);
+    free(stats);
+    if (started == 0) {
+        return COPY_FALLBACK;
+    }
+    return atomic_load(&job.failed) ? COPY_FAILED : COPY_DONE;
+}
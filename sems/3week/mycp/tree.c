@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "mycp.h"
+
+// Пара открытых каталогов (источник, приемник). Файлы в очереди ссылаются на нее,
+// поэтому копирующие потоки открывают файлы через openat без разбора полного пути.
+// Закрывает каталоги тот, кто отпустил последнюю ссылку: к этому моменту поддерево
+// скопировано, и приемнику можно вернуть права источника
+struct dir_pair_t {
+    int fd_IN;
+    int fd_OUT;
+    mode_t mode;            // права для приемника, если он создан нами
+    bool restore_mode;
+    char* rel_path;         // для сообщений, "" - корень копии
+    atomic_size_t refcount;
+};
+
+struct tree_task_t {
+    struct dir_pair_t* dirs;
+    char* rel_path;         // путь от корня копии, только для сообщений
+    const char* name;       // последний компонент rel_path
+};
+
+struct tree_queue_t {
+    struct tree_task_t tasks[TREE_QUEUE_SIZE];
+    size_t head;
+    size_t count;
+    bool closed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+struct tree_copy_t {
+    struct tree_queue_t queue;
+    struct flags_states* flags;
+    int open_flags;
+    const char* IN_root;
+    const char* OUT_root;
+    mode_t umask;
+    atomic_size_t errors;
+
+    // Каждая пара держит 2 дескриптора, а файлы в очереди не дают закрыть свои пары.
+    // Обходчик ждет, пока пар не станет меньше max_dirs, но не ради своих предков:
+    // их освободит только он сам
+    pthread_mutex_t dirs_lock;
+    pthread_cond_t dirs_released;
+    size_t open_dirs;
+    size_t max_dirs;
+};
+
+static struct dir_pair_t* dir_pair_new(struct tree_copy_t* tree, int fd_IN, int fd_OUT, const char* rel_path) {
+    struct dir_pair_t* dirs = calloc(1, sizeof(*dirs));
+    char* path_copy = strdup(rel_path);
+    if (dirs == NULL || path_copy == NULL) {
+        free(dirs);
+        free(path_copy);
+        return NULL;
+    }
+    dirs->fd_IN    = fd_IN;
+    dirs->fd_OUT   = fd_OUT;
+    dirs->rel_path = path_copy;
+    atomic_init(&dirs->refcount, 1);
+
+    pthread_mutex_lock(&tree->dirs_lock);
+    tree->open_dirs += 1;
+    pthread_mutex_unlock(&tree->dirs_lock);
+    return dirs;
+}
+
+static void dir_pair_get(struct dir_pair_t* dirs) {
+    atomic_fetch_add(&dirs->refcount, 1);
+}
+
+static void dir_pair_put(struct tree_copy_t* tree, struct dir_pair_t* dirs) {
+    if (atomic_fetch_sub(&dirs->refcount, 1) != 1) {
+        return;
+    }
+    if (dirs->restore_mode && fchmod(dirs->fd_OUT, dirs->mode & ~tree->umask) < 0) {
+        fprintf(stderr, "file name: [%s/%s]\n", tree->OUT_root, dirs->rel_path);
+        perror("Error in fchmod");
+        atomic_fetch_add(&tree->errors, 1);
+    }
+    close(dirs->fd_IN);
+    close(dirs->fd_OUT);
+    free(dirs->rel_path);
+    free(dirs);
+
+    pthread_mutex_lock(&tree->dirs_lock);
+    tree->open_dirs -= 1;
+    pthread_cond_signal(&tree->dirs_released);
+    pthread_mutex_unlock(&tree->dirs_lock);
+}
+
+// held - сколько пар держит сам обходчик: цепочка от корня до текущего каталога
+static void wait_for_dir_slot(struct tree_copy_t* tree, size_t held) {
+    pthread_mutex_lock(&tree->dirs_lock);
+    while (tree->open_dirs >= tree->max_dirs && tree->open_dirs > held) {
+        pthread_cond_wait(&tree->dirs_released, &tree->dirs_lock);
+    }
+    pthread_mutex_unlock(&tree->dirs_lock);
+}
+
+// Пары каталогов, которые можно держать открытыми: лимит дескрипторов без стандартных
+// потоков, запаса и пар файлов, которые копируют потоки пула
+static size_t max_dir_pairs(size_t jobs) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return SIZE_MAX;
+    }
+    size_t reserved = TREE_RESERVED_FDS + 2 * jobs;
+    return limit.rlim_cur > reserved + 2 ? (limit.rlim_cur - reserved) / 2 : 1;
+}
+
+static void queue_init(struct tree_queue_t* queue) {
+    queue->head   = 0;
+    queue->count  = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+static void queue_destroy(struct tree_queue_t* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+// Блокирует обходчик, пока копирующие потоки не разберут очередь
+static void queue_push(struct tree_queue_t* queue, struct tree_task_t task) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == TREE_QUEUE_SIZE) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->tasks[(queue->head + queue->count) % TREE_QUEUE_SIZE] = task;
+    queue->count += 1;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// false - очередь закрыта и пуста, работы больше не будет
+static bool queue_pop(struct tree_queue_t* queue, struct tree_task_t* task) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && ! queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    *task = queue->tasks[queue->head];
+    queue->head   = (queue->head + 1) % TREE_QUEUE_SIZE;
+    queue->count -= 1;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static void queue_close(struct tree_queue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// dir == "" означает корень копии
+static char* join_path(const char* dir, const char* name) {
+    if (*dir == '\0') {
+        return strdup(name);
+    }
+    size_t len = strlen(dir) + 1 + strlen(name) + 1;
+    char* path = malloc(len);
+    if (path != NULL) {
+        snprintf(path, len, "%s/%s", dir, name);
+    }
+    return path;
+}
+
+static void* tree_worker(void* arg) {
+    struct tree_copy_t* tree = arg;
+
+    struct tree_task_t task;
+    while (queue_pop(&tree->queue, &task)) {
+        int pstream_res = pstreamat(task.dirs->fd_IN, task.name, task.dirs->fd_OUT, task.name,
+                                    tree->open_flags, tree->flags);
+        if (pstream_res != 0) {
+            atomic_fetch_add(&tree->errors, 1);
+        } else if (tree->flags->verbose) {
+            printf("\'%s/%s\' -> \'%s/%s\'\n", tree->IN_root, task.rel_path, tree->OUT_root, task.rel_path);
+        }
+        dir_pair_put(tree, task.dirs);
+        free(task.rel_path);
+    }
+    return NULL;
+}
+
+static void copy_symlink(struct tree_copy_t* tree, struct dir_pair_t* dirs, const char* name, const char* rel_path) {
+    char target[BUFSIZ];
+    ssize_t len = readlinkat(dirs->fd_IN, name, target, sizeof(target) - 1);
+    if (len < 0) {
+        fprintf(stderr, "file name: [%s]\n", rel_path);
+        perror("Error in readlinkat");
+        atomic_fetch_add(&tree->errors, 1);
+        return;
+    }
+    target[len] = '\0';
+
+    if (tree->flags->force) {
+        unlinkat(dirs->fd_OUT, name, 0);
+    }
+    if (symlinkat(target, dirs->fd_OUT, name) < 0) {
+        fprintf(stderr, "file name: [%s]\n", rel_path);
+        perror("Error in symlinkat");
+        atomic_fetch_add(&tree->errors, 1);
+        return;
+    }
+    if (tree->flags->verbose) {
+        printf("\'%s/%s\' -> \'%s/%s\'\n", tree->IN_root, rel_path, tree->OUT_root, rel_path);
+    }
+}
+
+// Создает каталог в приемнике (существующий переиспользуется) и открывает его.
+// Пока поддерево копируется, владельцу нужны все права на каталог; если у источника
+// их нет, created сообщает, что права надо вернуть в dir_pair_put
+static int make_dir_at(int dirfd, const char* name, mode_t mode, bool* created) {
+    *created = mkdirat(dirfd, name, mode | S_IRWXU) == 0;
+    if (! *created && errno != EEXIST) {
+        return -1;
+    }
+    return openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+}
+
+static struct dir_pair_t* open_dir_pair(struct tree_copy_t* tree, int fd_IN, int fd_OUT, mode_t mode,
+                                        bool created, const char* rel_path) {
+    struct dir_pair_t* dirs = dir_pair_new(tree, fd_IN, fd_OUT, rel_path);
+    if (dirs != NULL) {
+        dirs->mode         = mode;
+        dirs->restore_mode = created && (mode & S_IRWXU) != S_IRWXU;
+    }
+    return dirs;
+}
+
+// Обход в глубину идет в вызывающем потоке, копирование файлов - в пуле.
+// Дескриптор dirs->fd_IN здесь переходит во владение DIR*, поэтому он дублируется.
+// depth - сколько пар, считая dirs, держит обходчик
+static void walk_dir(struct tree_copy_t* tree, struct dir_pair_t* dirs, const char* rel_path, size_t depth) {
+    int fd_list = dup(dirs->fd_IN);
+    DIR* dir = fd_list < 0 ? NULL : fdopendir(fd_list);
+    if (dir == NULL) {
+        fprintf(stderr, "file name: [%s]\n", rel_path);
+        perror("Error in fdopendir");
+        if (fd_list >= 0) {
+            close(fd_list);
+        }
+        atomic_fetch_add(&tree->errors, 1);
+        return;
+    }
+
+    struct dirent* entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char* child_path = join_path(rel_path, entry->d_name);
+        if (child_path == NULL) {
+            perror("Error in malloc");
+            atomic_fetch_add(&tree->errors, 1);
+            break;
+        }
+        const char* child_name = child_path + strlen(child_path) - strlen(entry->d_name);
+
+        struct stat st;
+        if (fstatat(dirs->fd_IN, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            fprintf(stderr, "file name: [%s]\n", child_path);
+            perror("Error in fstatat");
+            atomic_fetch_add(&tree->errors, 1);
+            free(child_path);
+            continue;
+        }
+
+        if (S_ISREG(st.st_mode)) {
+            dir_pair_get(dirs);
+            struct tree_task_t task = {dirs, child_path, child_name};
+            queue_push(&tree->queue, task);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            wait_for_dir_slot(tree, depth);
+            bool created = false;
+            int fd_IN  = openat(dirs->fd_IN, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            int fd_OUT = fd_IN < 0 ? -1 : make_dir_at(dirs->fd_OUT, entry->d_name, st.st_mode & 07777, &created);
+            struct dir_pair_t* child = fd_OUT < 0 ? NULL :
+                                       open_dir_pair(tree, fd_IN, fd_OUT, st.st_mode & 07777, created, child_path);
+            if (child == NULL) {
+                fprintf(stderr, "file name: [%s]\n", child_path);
+                perror("Error while opening directory");
+                if (fd_IN >= 0) {
+                    close(fd_IN);
+                }
+                if (fd_OUT >= 0) {
+                    close(fd_OUT);
+                }
+                atomic_fetch_add(&tree->errors, 1);
+            } else {
+                walk_dir(tree, child, child_path, depth + 1);
+                dir_pair_put(tree, child);
+            }
+        } else if (S_ISLNK(st.st_mode)) {
+            copy_symlink(tree, dirs, entry->d_name, child_path);
+        } else {
+            fprintf(stderr, "mycp: skipping special file '%s/%s'\n", tree->IN_root, child_path);
+        }
+        free(child_path);
+    }
+    closedir(dir);
+}
+
+static size_t tree_jobs_count(struct flags_states* flags) {
+    if (flags->jobs > 0) {
+        return flags->jobs;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
+
+int copy_tree(const char* IN_path, const char* OUT_path, int open_flags, struct flags_states* flags) {
+    assert(IN_path);
+    assert(OUT_path);
+    assert(flags);
+
+    struct tree_copy_t* tree = calloc(1, sizeof(*tree));
+    size_t jobs = tree_jobs_count(flags);
+    pthread_t* threads = calloc(jobs, sizeof(*threads));
+    if (tree == NULL || threads == NULL) {
+        perror("Error in calloc");
+        free(tree);
+        free(threads);
+        return -1;
+    }
+    queue_init(&tree->queue);
+    pthread_mutex_init(&tree->dirs_lock, NULL);
+    pthread_cond_init(&tree->dirs_released, NULL);
+    tree->flags      = flags;
+    tree->open_flags = open_flags;
+    tree->IN_root    = IN_path;
+    tree->OUT_root   = OUT_path;
+    tree->max_dirs   = max_dir_pairs(jobs);
+    atomic_init(&tree->errors, 0);
+    // umask можно только заменить, поэтому читаем его, пока других потоков нет
+    tree->umask = umask(0);
+    umask(tree->umask);
+
+    struct dir_pair_t* root = NULL;
+    struct stat st;
+    bool created = false;
+    int fd_IN  = open(IN_path, O_RDONLY | O_DIRECTORY);
+    int fd_OUT = -1;
+    if (fd_IN < 0 || fstat(fd_IN, &st) < 0) {
+        printf("file name: [%s]\n", IN_path);
+        perror("Error while opening directory");
+    } else if ((fd_OUT = make_dir_at(AT_FDCWD, OUT_path, st.st_mode & 07777, &created)) < 0) {
+        printf("file name: [%s]\n", OUT_path);
+        perror("Error while creating directory");
+    } else if ((root = open_dir_pair(tree, fd_IN, fd_OUT, st.st_mode & 07777, created, "")) == NULL) {
+        perror("Error in calloc");
+    }
+
+    size_t started = 0;
+    if (root == NULL) {
+        if (fd_IN >= 0) {
+            close(fd_IN);
+        }
+        if (fd_OUT >= 0) {
+            close(fd_OUT);
+        }
+        atomic_fetch_add(&tree->errors, 1);
+        jobs = 0;
+    }
+    for (; started < jobs; started++) {
+        int create_res = pthread_create(&threads[started], NULL, tree_worker, tree);
+        if (create_res != 0) {
+            errno = create_res;
+            perror("Error in pthread_create");
+            break;
+        }
+    }
+    if (root != NULL && started == 0) {
+        // без пула очередь некому разбирать, так что обход просто не начинаем
+        atomic_fetch_add(&tree->errors, 1);
+    } else if (root != NULL) {
+        walk_dir(tree, root, "", 1);
+    }
+    queue_close(&tree->queue);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (root != NULL) {
+        dir_pair_put(tree, root);
+    }
+
+    size_t errors = atomic_load(&tree->errors);
+    if (flags->verbose_count >= 2) {
+        printf("tree copy: %zu threads, %zu errors\n", started, errors);
+    }
+    queue_destroy(&tree->queue);
+    pthread_mutex_destroy(&tree->dirs_lock);
+    pthread_cond_destroy(&tree->dirs_released);
+    free(threads);
+    free(tree);
+    return errors == 0 ? 0 : -1;
+}
@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "mycp.h"
+
+// liburing в зависимостях нет, поэтому кольца настраиваем сами через syscall
+
+struct uring_t {
+    int fd;
+    unsigned sq_entries;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sqe_tail;          // локальный хвост, публикуется в uring_submit_and_wait
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    size_t sqes_len;
+};
+
+enum uring_op_t {
+    UOP_OPEN_IN,
+    UOP_OPEN_OUT,
+    UOP_READ,
+    UOP_WRITE,
+    UOP_CLOSE,
+};
+
+// Одна копия в полете. На слот приходится не больше двух SQE одновременно
+// (пара openat или пара close), поэтому слотов вдвое меньше глубины очереди
+struct uring_slot_t {
+    const char* IN_path;
+    const char* OUT_path;
+    int fd_IN;
+    int fd_OUT;
+    bool active;
+    bool failed;
+    unsigned pending;
+
+    off_t offset;
+    size_t write_len;
+    size_t write_done;
+    char* buffer;
+};
+
+struct uring_copy_t {
+    struct uring_t ring;
+    struct uring_slot_t* slots;
+    size_t slots_count;
+    bool fixed_buffers;
+
+    const char* const* IN_paths;
+    const char* const* OUT_paths;
+    size_t files_count;
+    size_t next_file;
+    size_t failed_files;
+
+    int open_flags;
+    struct flags_states* flags;
+};
+
+// Чтения и записи через кольцо не попадают в syscr/syscw из /proc/self/io,
+// поэтому бенчмарк считает системные вызовы io_uring отдельно
+static atomic_ullong uring_syscalls;
+
+unsigned long long uring_syscall_count() {
+    return atomic_load(&uring_syscalls);
+}
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    atomic_fetch_add(&uring_syscalls, 1);
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    atomic_fetch_add(&uring_syscalls, 1);
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    atomic_fetch_add(&uring_syscalls, 1);
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_exit(struct uring_t* ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+static bool uring_init(struct uring_t* ring, unsigned entries) {
+    struct io_uring_params params = {};
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return false;
+    }
+    ring->sq_entries = params.sq_entries;
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_len = ring->cq_len > ring->sq_len ? ring->cq_len : ring->sq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        uring_exit(ring);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            uring_exit(ring);
+            return false;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_exit(ring);
+        return false;
+    }
+
+    ring->sq_head  = (unsigned*)((char*)ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail  = (unsigned*)((char*)ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask  = (unsigned*)((char*)ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ptr + params.sq_off.array);
+    ring->cq_head  = (unsigned*)((char*)ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail  = (unsigned*)((char*)ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask  = (unsigned*)((char*)ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*)((char*)ring->cq_ptr + params.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+    return true;
+}
+
+// Старые ядра создают кольцо, но не знают openat/close - тогда нам оно не подходит
+static bool uring_supports_ops(struct uring_t* ring) {
+    size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probe_size);
+    if (probe == NULL) {
+        return false;
+    }
+    bool supported = false;
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        const int needed_ops[] = {IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE};
+        supported = true;
+        for (size_t i = 0; i < sizeof(needed_ops) / sizeof(needed_ops[0]); i++) {
+            int op = needed_ops[i];
+            if (op > probe->last_op || ! (probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                supported = false;
+            }
+        }
+    }
+    free(probe);
+    return supported;
+}
+
+static struct io_uring_sqe* uring_get_sqe(struct uring_t* ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sq_head, memory_order_acquire);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sqe_tail += 1;
+    ring->to_submit += 1;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Отправляет накопленные SQE и ждет хотя бы одно завершение
+static int uring_submit_and_wait(struct uring_t* ring) {
+    atomic_store_explicit((_Atomic unsigned*)ring->sq_tail, ring->sqe_tail, memory_order_release);
+    while (true) {
+        int res = sys_io_uring_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (res >= 0) {
+            ring->to_submit -= res;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+static uint64_t make_user_data(size_t slot, enum uring_op_t op) {
+    return ((uint64_t)slot << 8) | op;
+}
+
+static struct io_uring_sqe* slot_sqe(struct uring_copy_t* copy, size_t slot, enum uring_op_t op, int fd) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&copy->ring);
+    // на слот не бывает больше двух SQE, и кольцо рассчитано на все слоты сразу
+    assert(sqe);
+    sqe->fd        = fd;
+    sqe->user_data = make_user_data(slot, op);
+    copy->slots[slot].pending += 1;
+    return sqe;
+}
+
+static struct io_uring_sqe* submit_open(struct uring_copy_t* copy, size_t slot, enum uring_op_t op,
+                                        const char* path, int open_flags) {
+    struct io_uring_sqe* sqe = slot_sqe(copy, slot, op, AT_FDCWD);
+    sqe->opcode     = IORING_OP_OPENAT;
+    sqe->addr       = (uintptr_t)path;
+    sqe->len        = 0666;
+    sqe->open_flags = open_flags;
+    return sqe;
+}
+
+static void submit_read(struct uring_copy_t* copy, size_t slot) {
+    struct uring_slot_t* s = &copy->slots[slot];
+    struct io_uring_sqe* sqe = slot_sqe(copy, slot, UOP_READ, s->fd_IN);
+    sqe->opcode = copy->fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->addr   = (uintptr_t)s->buffer;
+    sqe->len    = URING_BUFFER_SIZE;
+    sqe->off    = s->offset;
+    sqe->buf_index = slot;
+}
+
+static void submit_write(struct uring_copy_t* copy, size_t slot) {
+    struct uring_slot_t* s = &copy->slots[slot];
+    struct io_uring_sqe* sqe = slot_sqe(copy, slot, UOP_WRITE, s->fd_OUT);
+    sqe->opcode = copy->fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->addr   = (uintptr_t)(s->buffer + s->write_done);
+    sqe->len    = s->write_len - s->write_done;
+    sqe->off    = s->offset + s->write_done;
+    sqe->buf_index = slot;
+}
+
+// Закрывает все, что успело открыться; если закрывать нечего, слот освобождается сразу
+static void submit_close(struct uring_copy_t* copy, size_t slot) {
+    struct uring_slot_t* s = &copy->slots[slot];
+    if (s->fd_IN >= 0) {
+        struct io_uring_sqe* sqe = slot_sqe(copy, slot, UOP_CLOSE, s->fd_IN);
+        sqe->opcode = IORING_OP_CLOSE;
+    }
+    if (s->fd_OUT >= 0) {
+        struct io_uring_sqe* sqe = slot_sqe(copy, slot, UOP_CLOSE, s->fd_OUT);
+        sqe->opcode = IORING_OP_CLOSE;
+    }
+}
+
+static bool start_next_file(struct uring_copy_t* copy, size_t slot) {
+    if (copy->next_file == copy->files_count) {
+        return false;
+    }
+    struct uring_slot_t* s = &copy->slots[slot];
+    s->IN_path  = copy->IN_paths[copy->next_file];
+    s->OUT_path = copy->OUT_paths[copy->next_file];
+    copy->next_file += 1;
+
+    s->fd_IN   = -1;
+    s->fd_OUT  = -1;
+    s->active  = true;
+    s->failed  = false;
+    s->pending = 0;
+    s->offset  = 0;
+    // связка: если источник не открылся, приемник не создается (openat получит -ECANCELED)
+    submit_open(copy, slot, UOP_OPEN_IN, s->IN_path, O_RDONLY)->flags |= IOSQE_IO_LINK;
+    submit_open(copy, slot, UOP_OPEN_OUT, s->OUT_path, copy->open_flags);
+    return true;
+}
+
+static void finish_file(struct uring_copy_t* copy, size_t slot) {
+    struct uring_slot_t* s = &copy->slots[slot];
+    s->active = false;
+    if (s->failed) {
+        copy->failed_files += 1;
+    } else if (copy->flags->verbose) {
+        printf("copy engine: %s\n", copy_engine_name(ENGINE_URING));
+        printf("\'%s\' -> \'%s\'\n", s->IN_path, s->OUT_path);
+    }
+    start_next_file(copy, slot);
+}
+
+static void report_error(const char* path, const char* what, int err) {
+    printf("file name: [%s]\n", path);
+    errno = err;
+    perror(what);
+}
+
+static void handle_cqe(struct uring_copy_t* copy, const struct io_uring_cqe* cqe) {
+    size_t slot = cqe->user_data >> 8;
+    enum uring_op_t op = cqe->user_data & 0xff;
+    struct uring_slot_t* s = &copy->slots[slot];
+    s->pending -= 1;
+
+    switch (op) {
+        case UOP_OPEN_IN:
+        case UOP_OPEN_OUT:
+            if (cqe->res == -ECANCELED) {
+                s->failed = true;
+            } else if (cqe->res < 0) {
+                report_error(op == UOP_OPEN_IN ? s->IN_path : s->OUT_path, "Error while opening file", -cqe->res);
+                s->failed = true;
+            } else if (op == UOP_OPEN_IN) {
+                s->fd_IN = cqe->res;
+            } else {
+                s->fd_OUT = cqe->res;
+            }
+            if (s->pending == 0) {
+                if (s->failed) {
+                    submit_close(copy, slot);
+                } else {
+                    submit_read(copy, slot);
+                }
+            }
+            break;
+
+        case UOP_READ:
+            if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                submit_read(copy, slot);
+            } else if (cqe->res < 0) {
+                report_error(s->IN_path, "Error on read", -cqe->res);
+                s->failed = true;
+                submit_close(copy, slot);
+            } else if (cqe->res == 0) {
+                submit_close(copy, slot);
+            } else {
+                s->write_len  = cqe->res;
+                s->write_done = 0;
+                submit_write(copy, slot);
+            }
+            break;
+
+        case UOP_WRITE:
+            if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+                submit_write(copy, slot);
+            } else if (cqe->res <= 0) {
+                report_error(s->OUT_path, "Error in write", cqe->res == 0 ? EIO : -cqe->res);
+                s->failed = true;
+                submit_close(copy, slot);
+            } else {
+                s->write_done += cqe->res;
+                if (s->write_done < s->write_len) {
+                    submit_write(copy, slot);
+                } else {
+                    s->offset += s->write_len;
+                    submit_read(copy, slot);
+                }
+            }
+            break;
+
+        case UOP_CLOSE:
+            if (cqe->res < 0) {
+                report_error(s->IN_path, "Error while closing file", -cqe->res);
+                s->failed = true;
+            }
+            break;
+    }
+
+    // оба close отработали (или закрывать было нечего) - слот свободен
+    if (s->pending == 0 && (op == UOP_CLOSE || (s->fd_IN < 0 && s->fd_OUT < 0))) {
+        finish_file(copy, slot);
+    }
+}
+
+static void reap_completions(struct uring_copy_t* copy) {
+    struct uring_t* ring = &copy->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned*)ring->cq_tail, memory_order_acquire);
+    while (head != tail) {
+        // копия cqe: обработчик добавляет новые SQE, но CQ не трогает
+        struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+        head += 1;
+        atomic_store_explicit((_Atomic unsigned*)ring->cq_head, head, memory_order_release);
+        handle_cqe(copy, &cqe);
+    }
+}
+
+static bool setup_buffers(struct uring_copy_t* copy) {
+    char* arena = NULL;
+    if (posix_memalign((void**)&arena, sysconf(_SC_PAGESIZE), copy->slots_count * URING_BUFFER_SIZE) != 0) {
+        return false;
+    }
+    struct iovec* iov = calloc(copy->slots_count, sizeof(*iov));
+    if (iov == NULL) {
+        free(arena);
+        return false;
+    }
+    for (size_t i = 0; i < copy->slots_count; i++) {
+        copy->slots[i].buffer = arena + i * URING_BUFFER_SIZE;
+        iov[i].iov_base = copy->slots[i].buffer;
+        iov[i].iov_len  = URING_BUFFER_SIZE;
+    }
+    // регистрация может упереться в RLIMIT_MEMLOCK - тогда работаем с обычными буферами
+    copy->fixed_buffers = sys_io_uring_register(copy->ring.fd, IORING_REGISTER_BUFFERS,
+                                                iov, copy->slots_count) == 0;
+    free(iov);
+    return true;
+}
+
+enum copy_status_t copy_files_uring(const char* const* IN_paths, const char* const* OUT_paths, size_t count,
+                                    int open_flags, struct flags_states* flags) {
+    assert(IN_paths);
+    assert(OUT_paths);
+    assert(flags);
+
+    struct uring_copy_t copy = {
+        .IN_paths    = IN_paths,
+        .OUT_paths   = OUT_paths,
+        .files_count = count,
+        .open_flags  = open_flags,
+        .flags       = flags,
+    };
+    if (! uring_init(&copy.ring, flags->queue_depth)) {
+        return COPY_FALLBACK;
+    }
+    if (! uring_supports_ops(&copy.ring)) {
+        uring_exit(&copy.ring);
+        return COPY_FALLBACK;
+    }
+
+    copy.slots_count = copy.ring.sq_entries / 2;
+    copy.slots = calloc(copy.slots_count, sizeof(*copy.slots));
+    if (copy.slots == NULL || ! setup_buffers(&copy)) {
+        free(copy.slots);
+        uring_exit(&copy.ring);
+        return COPY_FALLBACK;
+    }
+    if (flags->verbose_count >= 2) {
+        printf("io_uring: %zu files in flight, %s buffers\n",
+               copy.slots_count, copy.fixed_buffers ? "registered" : "plain");
+    }
+
+    size_t active = 0;
+    for (size_t slot = 0; slot < copy.slots_count && start_next_file(&copy, slot); slot++) {
+        active++;
+    }
+    enum copy_status_t status = COPY_DONE;
+    while (active > 0) {
+        if (uring_submit_and_wait(&copy.ring) < 0) {
+            perror("Error in io_uring_enter");
+            status = COPY_FAILED;
+            break;
+        }
+        reap_completions(&copy);
+
+        active = 0;
+        for (size_t slot = 0; slot < copy.slots_count; slot++) {
+            active += copy.slots[slot].active;
+        }
+    }
+
+    free(copy.slots[0].buffer);
+    free(copy.slots);
+    uring_exit(&copy.ring);
+    if (copy.failed_files > 0) {
+        status = COPY_FAILED;
+    }
+    return status;
+}
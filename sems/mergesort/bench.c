@@ -0,0 +1,304 @@
+#include <stdint.h>
+#include <getopt.h>
+
+#include "mergesort.h"
+
+enum distribution_t {
+    DIST_UNIFORM,
+    DIST_SORTED,
+    DIST_REVERSE,
+    DIST_FEW_UNIQUE,
+    DIST_ZIPF,
+};
+
+static const char* const DISTRIBUTION_NAMES[] = {"uniform", "sorted", "reverse", "few_unique", "zipf"};
+
+#define DISTRIBUTIONS_COUNT (sizeof(DISTRIBUTION_NAMES) / sizeof(DISTRIBUTION_NAMES[0]))
+
+// few_unique: столько различных значений
+#define FEW_UNIQUE_VALUES 16
+
+// zipf: ранги 1..ZIPF_MAX_RANK с вероятностью ~ 1/rank
+#define ZIPF_MAX_RANK (1 << 20)
+
+struct bench_options_t {
+    size_t min_size;
+    size_t max_size;
+    size_t max_threads;
+    size_t repeats;
+};
+
+// Сравнение линейного слияния и дерева проигравших при росте числа фрагментов
+static void bench_merge(struct pool_t* pool) {
+    const size_t total = 1 << 22;
+    int* array = malloc(total * sizeof(int));
+    int* out   = malloc(total * sizeof(int));
+    assert(array && out);
+
+    printf("runs,linear_ms,loser_tree_ms,speedup,parallel_%zu_ms\n", pool_threads(pool));
+    for (size_t runs = 2; runs <= 256; runs *= 2) {
+        size_t* starts = malloc(runs * sizeof(size_t));
+        size_t* ends   = malloc(runs * sizeof(size_t));
+        assert(starts && ends);
+
+        unsigned seed = 1;
+        for (size_t i = 0; i < total; i++) {
+            array[i] = rand_r(&seed);
+        }
+        for (size_t r = 0; r < runs; r++) {
+            starts[r] = r * (total / runs);
+            ends[r]   = (r + 1 == runs) ? total : (r + 1) * (total / runs);
+            qsort(array + starts[r], ends[r] - starts[r], sizeof(int), comparator);
+        }
+
+        double t0 = now_seconds();
+        merge_linear(array, starts, ends, runs, out);
+        double t1 = now_seconds();
+        merge_runs(array, starts, ends, runs, out);
+        double t2 = now_seconds();
+        merge_parallel(array, starts, ends, runs, out, pool);
+        double t3 = now_seconds();
+
+        printf("%zu,%.1f,%.1f,%.2f,%.1f\n", runs, (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1),
+               (t3 - t2) * 1e3);
+        free(starts);
+        free(ends);
+    }
+    free(array);
+    free(out);
+}
+
+// Сортировка одного фрагмента: qsort с компаратором против sort_ints
+static void bench_kernel() {
+    printf("run_size,qsort_ms,sort_ints_ms,speedup\n");
+    for (size_t size = 1 << 6; size <= (1 << 22); size *= 4) {
+        // мелкие фрагменты повторяем, чтобы время было измеримым
+        size_t repeats = ((size_t)1 << 22) / size;
+        int* source = malloc(size * sizeof(int));
+        int* array  = malloc(size * sizeof(int));
+        assert(source && array);
+
+        unsigned seed = 1;
+        for (size_t i = 0; i < size; i++) {
+            source[i] = rand_r(&seed) - RAND_MAX / 2;
+        }
+
+        double qsort_time = 0;
+        double kernel_time = 0;
+        for (size_t r = 0; r < repeats; r++) {
+            memcpy(array, source, size * sizeof(int));
+            double t0 = now_seconds();
+            qsort(array, size, sizeof(int), comparator);
+            double t1 = now_seconds();
+            memcpy(array, source, size * sizeof(int));
+            double t2 = now_seconds();
+            sort_ints(array, size);
+            double t3 = now_seconds();
+            qsort_time  += t1 - t0;
+            kernel_time += t3 - t2;
+        }
+        printf("%zu,%.1f,%.1f,%.2f\n", size, qsort_time * 1e3, kernel_time * 1e3, qsort_time / kernel_time);
+        free(source);
+        free(array);
+    }
+}
+
+// xorshift64*: rand_r дает только 31 бит и слишком медленный для генерации 1G чисел
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Ранг по обратной функции распределения: бинарный поиск в накопленных весах
+static int zipf_sample(const double* cdf, size_t ranks, uint64_t* state) {
+    double u = (next_random(state) >> 11) * (1.0 / (1ULL << 53));
+    size_t lo = 0;
+    size_t hi = ranks - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int)lo + 1;
+}
+
+static void generate(int* array, size_t size, enum distribution_t distribution) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    switch (distribution) {
+        case DIST_UNIFORM:
+            for (size_t i = 0; i < size; i++) {
+                array[i] = (int)(uint32_t)next_random(&state);
+            }
+            break;
+        case DIST_SORTED:
+            for (size_t i = 0; i < size; i++) {
+                array[i] = (int)(i - size / 2);
+            }
+            break;
+        case DIST_REVERSE:
+            for (size_t i = 0; i < size; i++) {
+                array[i] = (int)(size / 2 - i);
+            }
+            break;
+        case DIST_FEW_UNIQUE:
+            for (size_t i = 0; i < size; i++) {
+                array[i] = (int)(next_random(&state) % FEW_UNIQUE_VALUES);
+            }
+            break;
+        case DIST_ZIPF: {
+            size_t ranks = min_size_t(max_size_t(size, 1), ZIPF_MAX_RANK);
+            double* cdf = malloc(ranks * sizeof(double));
+            assert(cdf);
+            double sum = 0;
+            for (size_t r = 0; r < ranks; r++) {
+                sum += 1.0 / (r + 1);
+                cdf[r] = sum;
+            }
+            for (size_t r = 0; r < ranks; r++) {
+                cdf[r] /= sum;
+            }
+            for (size_t i = 0; i < size; i++) {
+                array[i] = zipf_sample(cdf, ranks, &state);
+            }
+            free(cdf);
+            break;
+        }
+    }
+}
+
+// 1, 2, 4, ... и само max_threads, если это не степень двойки
+static size_t next_threads(size_t threads, size_t max_threads) {
+    if (threads == max_threads) {
+        return 0;
+    }
+    return min_size_t(threads * 2, max_threads);
+}
+
+// Масштабирование parallel_sort: для каждого распределения и размера - лучший из
+// repeats прогонов на каждом числе потоков. Ускорение фаз считается относительно
+// одного потока на том же входе
+static void bench_scaling(const struct bench_options_t* options) {
+    int* source = malloc(options->max_size * sizeof(int));
+    int* array  = malloc(options->max_size * sizeof(int));
+    if (source == NULL || array == NULL) {
+        perror("Error in malloc");
+        free(source);
+        free(array);
+        return;
+    }
+
+    printf("distribution,elements,threads,runs,sort_s,merge_s,total_s,elements_per_s,"
+           "sort_speedup,merge_speedup,total_speedup\n");
+    for (size_t d = 0; d < DISTRIBUTIONS_COUNT; d++) {
+        for (size_t size = options->min_size; size <= options->max_size; size *= 4) {
+            generate(source, size, d);
+
+            struct sort_timing_t single = {};
+            for (size_t threads = 1; threads != 0; threads = next_threads(threads, options->max_threads)) {
+                struct pool_t* pool = pool_create(threads);
+                if (pool == NULL) {
+                    fprintf(stderr, "bench: failed to start %zu threads\n", threads);
+                    break;
+                }
+
+                struct sort_timing_t best = {};
+                for (size_t r = 0; r < options->repeats; r++) {
+                    memcpy(array, source, size * sizeof(int));
+                    struct sort_timing_t timing;
+                    free(parallel_sort(array, size, pool, &timing));
+                    if (r == 0 || timing.sort_seconds + timing.merge_seconds <
+                                  best.sort_seconds + best.merge_seconds) {
+                        best = timing;
+                    }
+                }
+                if (threads == 1) {
+                    single = best;
+                }
+                pool_destroy(pool);
+
+                double total = best.sort_seconds + best.merge_seconds;
+                double single_total = single.sort_seconds + single.merge_seconds;
+                printf("%s,%zu,%zu,%zu,%.6f,%.6f,%.6f,%.0f,%.2f,%.2f,%.2f\n",
+                       DISTRIBUTION_NAMES[d], size, threads, best.runs,
+                       best.sort_seconds, best.merge_seconds, total, size / total,
+                       single.sort_seconds / best.sort_seconds, single.merge_seconds / best.merge_seconds,
+                       single_total / total);
+                fflush(stdout);
+            }
+        }
+    }
+    free(source);
+    free(array);
+}
+
+// размер с суффиксом K/M/G, как у mergesort -m
+static bool parse_count(const char* arg, size_t* value) {
+    char* end = NULL;
+    long long parsed = strtoll(arg, &end, 10);
+    if (end == arg || parsed < 1) {
+        return false;
+    }
+    switch (*end) {
+        case '\0':                  break;
+        case 'K': case 'k':         parsed <<= 10; end++; break;
+        case 'M': case 'm':         parsed <<= 20; end++; break;
+        case 'G': case 'g':         parsed <<= 30; end++; break;
+        default:                    return false;
+    }
+    *value = parsed;
+    return *end == '\0';
+}
+
+int main(int argc, char* argv[]) {
+    struct bench_options_t options = {
+        .min_size    = 1 << 10,
+        .max_size    = 1 << 24,
+        .max_threads = default_threads(),
+        .repeats     = 3,
+    };
+    const char* mode = "scaling";
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "s:j:r:t:")) != -1) {
+        bool ok = true;
+        switch (opt) {
+            case 's': ok = parse_count(optarg, &options.max_size);    break;
+            case 'j': ok = parse_count(optarg, &options.max_threads); break;
+            case 'r': ok = parse_count(optarg, &options.repeats);     break;
+            case 't': mode = optarg;                                  break;
+            default:  ok = false;                                     break;
+        }
+        if (! ok) {
+            fprintf(stderr, "usage: %s [-s MAX_ELEMENTS] [-j MAX_THREADS] [-r REPEATS] [-t scaling|merge|kernel]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    options.min_size = min_size_t(options.min_size, options.max_size);
+
+    if (strcmp(mode, "kernel") == 0) {
+        bench_kernel();
+        return 0;
+    }
+    if (strcmp(mode, "scaling") == 0) {
+        bench_scaling(&options);
+        return 0;
+    }
+    if (strcmp(mode, "merge") != 0) {
+        fprintf(stderr, "bench: unknown mode '%s'\n", mode);
+        return 1;
+    }
+    struct pool_t* pool = pool_create(options.max_threads);
+    if (pool == NULL) {
+        fprintf(stderr, "bench: failed to start thread pool\n");
+        return 1;
+    }
+    bench_merge(pool);
+    pool_destroy(pool);
+    return 0;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "mergesort.h"
+
+// Отсортированный фрагмент, сброшенный на диск. Файл удален сразу после создания,
+// так что место освобождается при fclose даже после аварийного выхода
+struct run_file_t {
+    FILE* file;
+    size_t size;    // чисел в файле
+    size_t read;    // сколько уже прочитано в буфер слияния
+    size_t level;   // сколько слияний за фрагментом, у свежего куска 0
+};
+
+static FILE* create_run_file(const char* tmpdir) {
+    size_t len = strlen(tmpdir) + sizeof("/mergesort.XXXXXX");
+    char* path = malloc(len);
+    if (path == NULL) {
+        perror("Error in malloc");
+        return NULL;
+    }
+    snprintf(path, len, "%s/mergesort.XXXXXX", tmpdir);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "file name: [%s]\n", path);
+        perror("Error in mkstemp");
+        free(path);
+        return NULL;
+    }
+    unlink(path);
+    free(path);
+
+    FILE* file = fdopen(fd, "w+b");
+    if (file == NULL) {
+        perror("Error in fdopen");
+        close(fd);
+        return NULL;
+    }
+    return file;
+}
+
+// Дочитывает буфер фрагмента до capacity большими последовательными pread
+static int refill_run(struct run_file_t* run, int* buffer, size_t* filled, size_t capacity) {
+    while (*filled < capacity && run->read < run->size) {
+        size_t want = min_size_t(capacity - *filled, run->size - run->read);
+        ssize_t got = pread(fileno(run->file), buffer + *filled, want * sizeof(int), (off_t)(run->read * sizeof(int)));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0 || got % sizeof(int) != 0) {
+            perror("Error while reading run file");
+            return -1;
+        }
+        *filled   += got / sizeof(int);
+        run->read += got / sizeof(int);
+    }
+    return 0;
+}
+
+// Первый индекс окна [start, end), где значение больше bound
+static size_t upper_bound(const int* array, size_t start, size_t end, int bound) {
+    while (start < end) {
+        size_t mid = start + (end - start) / 2;
+        if (array[mid] <= bound) {
+            start = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return start;
+}
+
+// Слияние фрагментов с диска окнами. У каждого фрагмента свой буфер; пока у фрагмента
+// есть непрочитанный хвост, все числа не больше последнего числа его буфера уже видны.
+// Поэтому за раунд безопасно выдать все, что не больше минимума таких последних чисел:
+// эти окна сливаются обычным merge_parallel в пуле, фрагмент с минимумом расходуется
+// целиком, и следующий раунд начинается с дочитывания буферов
+static int merge_run_files(struct run_file_t* runs, size_t count, FILE* output, bool binary,
+                           size_t memory, struct pool_t* pool) {
+    // половина бюджета - буферы чтения, половина - выход слияния
+    size_t capacity = max_size_t(memory / sizeof(int) / (2 * count), 1);
+
+    int* buffers   = malloc(count * capacity * sizeof(int));
+    int* out       = malloc(count * capacity * sizeof(int));
+    size_t* filled = calloc(count, sizeof(size_t));
+    size_t* starts = malloc(count * sizeof(size_t));
+    size_t* ends   = malloc(count * sizeof(size_t));
+    int res = -1;
+    if (buffers == NULL || out == NULL || filled == NULL || starts == NULL || ends == NULL) {
+        perror("Error in malloc");
+        goto cleanup;
+    }
+    for (size_t i = 0; i < count; i++) {
+        posix_fadvise(fileno(runs[i].file), 0, 0, POSIX_FADV_SEQUENTIAL);
+        starts[i] = i * capacity;
+        ends[i]   = i * capacity;
+    }
+
+    while (true) {
+        bool bounded = false;
+        int bound = 0;
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            int* buffer = buffers + i * capacity;
+            // неслитый остаток окна сдвигаем в начало буфера
+            size_t left = i * capacity + filled[i] - ends[i];
+            memmove(buffer, buffers + ends[i], left * sizeof(int));
+            filled[i] = left;
+
+            if (refill_run(&runs[i], buffer, &filled[i], capacity) < 0) {
+                goto cleanup;
+            }
+            if (runs[i].read < runs[i].size && (! bounded || buffer[filled[i] - 1] < bound)) {
+                bound   = buffer[filled[i] - 1];
+                bounded = true;
+            }
+            total += filled[i];
+        }
+        if (total == 0) {
+            break;
+        }
+
+        total = 0;
+        for (size_t i = 0; i < count; i++) {
+            starts[i] = i * capacity;
+            ends[i]   = bounded ? upper_bound(buffers, starts[i], starts[i] + filled[i], bound)
+                                : starts[i] + filled[i];
+            total += ends[i] - starts[i];
+        }
+        merge_parallel(buffers, starts, ends, count, out, pool);
+        if (write_output(output, out, total, binary) < 0) {
+            goto cleanup;
+        }
+    }
+    res = 0;
+
+cleanup:
+    free(buffers);
+    free(out);
+    free(filled);
+    free(starts);
+    free(ends);
+    return res;
+}
+
+static void close_runs(struct run_file_t* runs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        fclose(runs[i].file);
+    }
+}
+
+// Сколько фрагментов можно держать открытыми: лимит дескрипторов без запаса на
+// stdin/stdout/stderr, входной файл и выходной фрагмент слияния
+static size_t max_open_runs(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return SIZE_MAX;
+    }
+    return limit.rlim_cur > EXTERNAL_RESERVED_FDS + 2 ? limit.rlim_cur - EXTERNAL_RESERVED_FDS : 2;
+}
+
+// Сколько фрагментов сливать за раз: чтобы буферы были не меньше EXTERNAL_MIN_BUFFER
+// и все фрагменты группы помещались в лимит дескрипторов
+static size_t run_fan_in(size_t memory) {
+    return min_size_t(max_size_t(memory / (2 * EXTERNAL_MIN_BUFFER), 2), max_open_runs());
+}
+
+// Сливает group фрагментов в новый файл merged. Исходные закрываются только при успехе
+static int merge_group(struct run_file_t* runs, size_t group, struct run_file_t* merged, size_t memory,
+                       const struct sort_options_t* options, struct pool_t* pool) {
+    struct run_file_t run = {create_run_file(options->tmpdir), 0, 0, 0};
+    if (run.file == NULL || merge_run_files(runs, group, run.file, true, memory, pool) < 0) {
+        if (run.file != NULL) {
+            fclose(run.file);
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < group; i++) {
+        run.size += runs[i].size;
+        run.level = max_size_t(run.level, runs[i].level + 1);
+    }
+    close_runs(runs, group);
+    *merged = run;
+    return 0;
+}
+
+// Пока фрагментов больше fan_in, сливаем их группами в новые файлы: мелкие буферы
+// превратили бы чтение в случайный доступ
+static int reduce_runs(struct run_file_t* runs, size_t* count, const struct sort_options_t* options,
+                       struct pool_t* pool) {
+    size_t fan_in = run_fan_in(options->memory);
+
+    while (*count > fan_in) {
+        size_t merged = 0;
+        for (size_t first = 0; first < *count; first += fan_in) {
+            size_t group = min_size_t(fan_in, *count - first);
+            if (merge_group(runs + first, group, &runs[merged], options->memory, options, pool) < 0) {
+                // открытыми остаются уже слитые и еще не тронутые фрагменты
+                memmove(runs + merged, runs + first, (*count - first) * sizeof(*runs));
+                *count = merged + *count - first;
+                return -1;
+            }
+            merged++;
+        }
+        if (options->verbose) {
+            fprintf(stderr, "merge pass: %zu runs -> %zu runs\n", *count, merged);
+        }
+        *count = merged;
+    }
+    return 0;
+}
+
+// Сортировка входа, который не помещается в options->memory байт: куски по половине
+// бюджета (вторая половина - выход parallel_sort) сортируются в пуле и сбрасываются во
+// временные файлы, затем файлы сливаются в output. Вход, уместившийся в первый кусок,
+// сортируется в памяти без временных файлов.
+// Чтобы число открытых фрагментов не росло с размером входа, уже при сбросе fan_in
+// последних фрагментов одного уровня сливаются в один, как разряды при счете в системе
+// с основанием fan_in; у лимита дескрипторов сливаются последние fan_in любых уровней.
+// Сливаем, только когда фрагментов больше fan_in: иначе хватит одного финального слияния
+int external_sort(FILE* input, FILE* output, const struct sort_options_t* options, struct pool_t* pool) {
+    assert(input);
+    assert(output);
+    assert(options);
+
+    size_t chunk = max_size_t(options->memory / (2 * sizeof(int)), 1);
+    int* buffer = malloc(chunk * sizeof(int));
+    if (buffer == NULL) {
+        perror("Error in malloc");
+        return -1;
+    }
+
+    struct run_file_t* runs = NULL;
+    size_t count = 0;
+    size_t spilled = 0;
+    int res = -1;
+
+    // пока идет сброс, слиянию достается половина бюджета, занятая выходом parallel_sort
+    size_t spill_memory = options->memory - min_size_t(options->memory, chunk * sizeof(int));
+    size_t spill_fan_in = run_fan_in(spill_memory);
+    size_t open_limit = max_open_runs();
+
+    while (true) {
+        long read_count = read_ints(input, options->binary, buffer, chunk);
+        if (read_count < 0) {
+            goto cleanup;
+        }
+        if (read_count == 0 && count > 0) {
+            break;
+        }
+
+        struct sort_timing_t timing;
+        int* sorted = parallel_sort(buffer, read_count, pool, &timing);
+        if (options->verbose) {
+            print_timing(read_count, pool, &timing);
+        }
+        if (count == 0 && (size_t)read_count < chunk) {
+            res = write_output(output, sorted, read_count, options->binary);
+            free(sorted);
+            goto cleanup;
+        }
+
+        struct run_file_t* grown = realloc(runs, (count + 1) * sizeof(*runs));
+        FILE* file = grown == NULL ? NULL : create_run_file(options->tmpdir);
+        if (grown != NULL) {
+            runs = grown;
+        }
+        if (file == NULL || write_output(file, sorted, read_count, true) < 0) {
+            if (file != NULL) {
+                fclose(file);
+            }
+            free(sorted);
+            goto cleanup;
+        }
+        free(sorted);
+        runs[count++] = (struct run_file_t){file, read_count, 0, 0};
+        spilled++;
+
+        while (count > spill_fan_in && (runs[count - spill_fan_in].level == runs[count - 1].level ||
+                                        count >= open_limit)) {
+            struct run_file_t* group = runs + count - spill_fan_in;
+            if (merge_group(group, spill_fan_in, group, spill_memory, options, pool) < 0) {
+                goto cleanup;
+            }
+            count -= spill_fan_in - 1;
+        }
+
+        if ((size_t)read_count < chunk) {
+            break;
+        }
+    }
+    // буфер кусков больше не нужен, весь бюджет отдаем слиянию
+    free(buffer);
+    buffer = NULL;
+
+    if (options->verbose) {
+        fprintf(stderr, "spilled %zu runs of up to %zu elements to %s, %zu left after merging\n",
+                spilled, chunk, options->tmpdir, count);
+    }
+    if (reduce_runs(runs, &count, options, pool) < 0) {
+        goto cleanup;
+    }
+    res = merge_run_files(runs, count, output, options->binary, options->memory, pool);
+
+cleanup:
+    close_runs(runs, count);
+    free(runs);
+    free(buffer);
+    return res;
+}
@@ -0,0 +1,227 @@
+#include <getopt.h>
+
+#include "mergesort.h"
+
+static bool parse_threads(const char* arg, size_t* threads) {
+    char* end = NULL;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value <= 0) {
+        fprintf(stderr, "mergesort: invalid thread count '%s'\n", arg);
+        return false;
+    }
+    *threads = (size_t)value;
+    return true;
+}
+
+// размер с суффиксом K/M/G, как --buffer-size у mycp
+static bool parse_size(const char* arg, size_t* value) {
+    char* end = NULL;
+    long long parsed = strtoll(arg, &end, 10);
+    if (*arg == '\0' || end == arg || parsed < 1) {
+        return false;
+    }
+    switch (*end) {
+        case '\0':                  break;
+        case 'K': case 'k':         parsed <<= 10; end++; break;
+        case 'M': case 'm':         parsed <<= 20; end++; break;
+        case 'G': case 'g':         parsed <<= 30; end++; break;
+        default:                    return false;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// -k OFFSET[,LENGTH]
+static bool parse_key(const char* arg, struct sort_options_t* options) {
+    char* end = NULL;
+    long long offset = strtoll(arg, &end, 10);
+    if (end == arg || offset < 0) {
+        return false;
+    }
+    options->key_offset = offset;
+    options->key_length = 0;
+    if (*end == ',') {
+        const char* length_arg = end + 1;
+        long long length = strtoll(length_arg, &end, 10);
+        if (end == length_arg || length < 1) {
+            return false;
+        }
+        options->key_length = length;
+    }
+    return *end == '\0';
+}
+
+static bool check_record_flags(struct sort_options_t* options) {
+    if (options->lines && options->record_size > 0) {
+        fprintf(stderr, "mergesort: --lines and --record-size are mutually exclusive\n");
+        return false;
+    }
+    if (! options->lines && options->record_size == 0) {
+        return true;
+    }
+    if (options->memory > 0) {
+        fprintf(stderr, "mergesort: --memory is supported only for int input\n");
+        return false;
+    }
+    if (options->lines || ! options->numeric) {
+        return true;
+    }
+    size_t length = options->key_length;
+    if (length != 1 && length != 2 && length != 4 && length != 8) {
+        fprintf(stderr, "mergesort: numeric binary key must be 1, 2, 4 or 8 bytes long\n");
+        return false;
+    }
+    if (options->key_offset + length > options->record_size) {
+        fprintf(stderr, "mergesort: key does not fit into %zu-byte record\n", options->record_size);
+        return false;
+    }
+    return true;
+}
+
+static bool check_flags(struct sort_options_t* options, int argc, char* argv[]) {
+    const struct option long_options[] = {
+        {"binary",  no_argument,       NULL, 'b'},
+        {"check",   no_argument,       NULL, 'c'},
+        {"verbose", no_argument,       NULL, 'v'},
+        {"jobs",    required_argument, NULL, 'j'},
+        {"memory",  required_argument, NULL, 'm'},
+        {"tmpdir",  required_argument, NULL, 'T'},
+        {"record-size", required_argument, NULL, 'r'},
+        {"lines",   no_argument,       NULL, 'l'},
+        {"key",     required_argument, NULL, 'k'},
+        {"numeric", no_argument,       NULL, 'n'},
+        {NULL,      0,                 NULL,  0 },
+    };
+
+    int opt = 0;
+    while ((opt = getopt_long(argc, argv, "bcvj:m:T:r:lk:n", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': options->binary  = true; break;
+            case 'c': options->check   = true; break;
+            case 'v': options->verbose = true; break;
+            case 'j':
+                if (! parse_threads(optarg, &options->threads)) {
+                    return false;
+                }
+                break;
+            case 'm':
+                if (! parse_size(optarg, &options->memory)) {
+                    fprintf(stderr, "mergesort: --memory expects a size like 512M or 4G, got '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'T':
+                options->tmpdir = optarg;
+                break;
+            case 'l': options->lines   = true; break;
+            case 'n': options->numeric = true; break;
+            case 'r':
+                if (! parse_size(optarg, &options->record_size)) {
+                    fprintf(stderr, "mergesort: invalid record size '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'k':
+                if (! parse_key(optarg, options)) {
+                    fprintf(stderr, "mergesort: --key expects OFFSET[,LENGTH], got '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-b] [-c] [-v] [-j threads] [-m memory [-T tmpdir]]\n"
+                                "       [-r size | -l] [-k offset[,length]] [-n] [file]\n", argv[0]);
+                return false;
+        }
+    }
+    return check_record_flags(options);
+}
+
+int main(int argc, char* argv[]) {
+    struct sort_options_t options = {.threads = default_threads()};
+    if (! check_flags(&options, argc, argv)) {
+        return 1;
+    }
+    if (options.tmpdir == NULL) {
+        options.tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    }
+    bool records = options.lines || options.record_size > 0;
+    if (options.memory > 0 && options.check) {
+        // результат не помещается в память, сверять его с qsort не с чем
+        fprintf(stderr, "mergesort: --check is ignored with --memory\n");
+        options.check = false;
+    }
+
+    // без аргумента или с "-" читаем stdin
+    FILE* input = stdin;
+    if (optind < argc && strcmp(argv[optind], "-") != 0) {
+        input = fopen(argv[optind], (options.binary || records) ? "rb" : "r");
+        if (input == NULL) {
+            fprintf(stderr, "file name: [%s]\n", argv[optind]);
+            perror("Error in fopen");
+            return 1;
+        }
+    }
+
+    struct pool_t* pool = pool_create(options.threads);
+    if (pool == NULL) {
+        fprintf(stderr, "mergesort: failed to start thread pool\n");
+        if (input != stdin) {
+            fclose(input);
+        }
+        return 1;
+    }
+
+    if (records) {
+        int records_res = sort_records(input, stdout, &options, pool);
+        pool_destroy(pool);
+        if (input != stdin) {
+            fclose(input);
+        }
+        return records_res == 0 ? 0 : 1;
+    }
+
+    if (options.memory > 0) {
+        int external_res = external_sort(input, stdout, &options, pool);
+        pool_destroy(pool);
+        if (input != stdin) {
+            fclose(input);
+        }
+        return external_res == 0 ? 0 : 1;
+    }
+
+    size_t size = 0;
+    int* array = read_input(input, options.binary, &size);
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (array == NULL) {
+        pool_destroy(pool);
+        return 1;
+    }
+
+    struct sort_timing_t timing;
+    int* new_array = parallel_sort(array, size, pool, &timing);
+    if (options.verbose) {
+        print_timing(size, pool, &timing);
+    }
+    pool_destroy(pool);
+    free(array);
+
+    int res = write_output(stdout, new_array, size, options.binary) == 0 ? 0 : 1;
+
+    // проверка сортировки
+    if (options.check) {
+        if (check_sorting(new_array, size)) {
+            fprintf(stderr, "Sorting failed\n");
+            res = 1;
+        } else {
+            fprintf(stderr, "Sorting succesful\n");
+        }
+    }
+
+    free(new_array);
+    return res;
+}
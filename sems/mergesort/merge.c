@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "mergesort.h"
+
+size_t find_min_in_current_slice(const int* array, size_t indices[], const size_t ends[], size_t runs) {
+    assert(array);
+
+    size_t target_ind = 0;
+    int min_val = INT_MAX;
+    bool found = false;
+
+    DBG_PRINT("find min in: ");
+    for (size_t i = 0; i < runs; i++) {
+        DBG_PRINT("%d(%ld) ", array[indices[i]], indices[i]);
+    }
+    DBG_PRINT("\n");
+
+    for (size_t i = 0; i < runs; i++) {
+        // проверка что еще не вышли из отсортированного фрагмента
+        if (indices[i] < ends[i]) {
+            int temp = array[indices[i]];
+            if (!found || temp < min_val) {
+                min_val = temp;
+                target_ind = i;
+                found = true;
+            }
+        }
+    }
+
+    if (!found) return runs;  // Все фрагменты закончились
+    return target_ind;
+}
+
+// Слияние линейным поиском минимума: O(M * runs). Оставлено для сравнения в --bench-merge
+void merge_linear(const int* array, const size_t starts[], const size_t ends[], size_t runs, int* out) {
+    assert(array);
+    assert(out);
+
+    size_t* indices = malloc(runs * sizeof(size_t));
+    assert(indices);
+    memcpy(indices, starts, runs * sizeof(size_t));
+
+    size_t out_ind = 0;
+    while (true) {
+        size_t min_ind = find_min_in_current_slice(array, indices, ends, runs);
+        if (min_ind >= runs) break;  // Все фрагменты обработаны
+
+        out[out_ind++] = array[indices[min_ind]];
+        indices[min_ind]++;
+    }
+    free(indices);
+}
+
+// Дерево проигравших (tournament tree) над runs отсортированными фрагментами.
+// Во внутренних узлах tree[1..runs-1] хранятся проигравшие своих матчей, в tree[0] - общий
+// победитель. После выдачи элемента переигрывается только путь от листа победителя
+// до корня, так что слияние стоит O(M log runs) вместо O(M * runs)
+struct loser_tree_t {
+    const int* array;
+    size_t* indices;            // текущая голова каждого фрагмента
+    const size_t* ends;
+    size_t runs;
+    size_t* tree;
+};
+
+// a побеждает b: закончившийся фрагмент проигрывает всем, при равенстве
+// выигрывает фрагмент с меньшим номером - слияние остается устойчивым
+static bool loser_tree_beats(const struct loser_tree_t* lt, size_t a, size_t b) {
+    bool a_done = lt->indices[a] >= lt->ends[a];
+    bool b_done = lt->indices[b] >= lt->ends[b];
+    if (a_done || b_done) {
+        return !a_done;
+    }
+    int va = lt->array[lt->indices[a]];
+    int vb = lt->array[lt->indices[b]];
+    return va < vb || (va == vb && a < b);
+}
+
+static void loser_tree_build(struct loser_tree_t* lt) {
+    size_t runs = lt->runs;
+    if (runs == 1) {
+        lt->tree[0] = 0;
+        return;
+    }
+    // winners[runs + i] - лист фрагмента i, winners[p] - победитель узла p
+    size_t* winners = malloc(2 * runs * sizeof(size_t));
+    assert(winners);
+    for (size_t i = 0; i < runs; i++) {
+        winners[runs + i] = i;
+    }
+    for (size_t p = runs - 1; p >= 1; p--) {
+        size_t a = winners[2 * p];
+        size_t b = winners[2 * p + 1];
+        if (loser_tree_beats(lt, a, b)) {
+            winners[p] = a;
+            lt->tree[p] = b;
+        } else {
+            winners[p] = b;
+            lt->tree[p] = a;
+        }
+    }
+    lt->tree[0] = winners[1];
+    free(winners);
+}
+
+// Голова победителя сдвинулась - переигрываем его путь до корня
+static void loser_tree_replay(struct loser_tree_t* lt) {
+    size_t winner = lt->tree[0];
+    for (size_t p = (winner + lt->runs) / 2; p >= 1; p /= 2) {
+        if (loser_tree_beats(lt, lt->tree[p], winner)) {
+            size_t tmp = lt->tree[p];
+            lt->tree[p] = winner;
+            winner = tmp;
+        }
+    }
+    lt->tree[0] = winner;
+}
+
+void merge_runs(const int* array, const size_t starts[], const size_t ends[], size_t runs, int* out) {
+    assert(array);
+    assert(out);
+    assert(runs > 0);
+
+    struct loser_tree_t lt = {
+        .array   = array,
+        .indices = malloc(runs * sizeof(size_t)),
+        .ends    = ends,
+        .runs    = runs,
+        .tree    = malloc(runs * sizeof(size_t)),
+    };
+    assert(lt.indices && lt.tree);
+    memcpy(lt.indices, starts, runs * sizeof(size_t));
+    loser_tree_build(&lt);
+
+    size_t out_ind = 0;
+    while (true) {
+        size_t winner = lt.tree[0];
+        if (lt.indices[winner] >= lt.ends[winner]) break;  // Все фрагменты обработаны
+
+        DBG_PRINT("found min: %d(%ld)\n", array[lt.indices[winner]], lt.indices[winner]);
+        out[out_ind++] = array[lt.indices[winner]];
+        lt.indices[winner]++;
+        loser_tree_replay(&lt);
+    }
+    free(lt.indices);
+    free(lt.tree);
+}
+
+// Число элементов фрагмента [start, end), строго меньших value (upper == false) или не больших (upper == true)
+static size_t run_rank(const int* array, size_t start, size_t end, int value, bool upper) {
+    size_t lo = start;
+    size_t hi = end;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (array[mid] < value || (upper && array[mid] == value)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - start;
+}
+
+// Merge path для runs фрагментов: находит в каждом фрагменте позицию splits[i] так, что
+// вместе они отдают ровно rank наименьших элементов. Бинарный поиск идет по значению:
+// ищем наименьшее v, не меньшее rank-го элемента, берем все элементы < v, а недостающие
+// равные v добираем из фрагментов по порядку номеров - как это сделало бы устойчивое слияние
+void split_runs(const int* array, const size_t starts[], const size_t ends[], size_t runs,
+                size_t rank, size_t splits[]) {
+    assert(array);
+
+    long long lo = INT_MIN;
+    long long hi = INT_MAX;
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        size_t count = 0;
+        for (size_t i = 0; i < runs; i++) {
+            count += run_rank(array, starts[i], ends[i], (int)mid, true);
+        }
+        if (count >= rank) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    size_t taken = 0;
+    for (size_t i = 0; i < runs; i++) {
+        splits[i] = starts[i] + run_rank(array, starts[i], ends[i], (int)lo, false);
+        taken += splits[i] - starts[i];
+    }
+    for (size_t i = 0; i < runs && taken < rank; i++) {
+        size_t equal = starts[i] + run_rank(array, starts[i], ends[i], (int)lo, true) - splits[i];
+        size_t take  = min_size_t(equal, rank - taken);
+        splits[i] += take;
+        taken     += take;
+    }
+}
+
+struct merge_slice_t {
+    const int* array;
+    const size_t* starts;
+    const size_t* ends;
+    size_t runs;
+    size_t total;
+    size_t index;       // номер куска выхода
+    size_t slices;
+    int* out;
+};
+
+// Каждая задача сама ищет границы своего куска выхода и сливает его независимо от остальных
+static void merge_slice(struct pool_t* pool, void* arg) {
+    assert(arg);
+    (void)pool;
+    struct merge_slice_t* slice = arg;
+
+    size_t rank_lo = slice->total * slice->index / slice->slices;
+    size_t rank_hi = slice->total * (slice->index + 1) / slice->slices;
+
+    size_t* lo = malloc(slice->runs * sizeof(size_t));
+    size_t* hi = malloc(slice->runs * sizeof(size_t));
+    assert(lo && hi);
+    split_runs(slice->array, slice->starts, slice->ends, slice->runs, rank_lo, lo);
+    split_runs(slice->array, slice->starts, slice->ends, slice->runs, rank_hi, hi);
+
+    merge_runs(slice->array, lo, hi, slice->runs, slice->out + rank_lo);
+
+    free(lo);
+    free(hi);
+}
+
+// Выход делится на SLICES_PER_THREAD кусков на поток пула: куски равны по числу
+// элементов, но не по цене поиска границ, так что лишние куски разбирают освободившиеся потоки
+void merge_parallel(const int* array, const size_t starts[], const size_t ends[], size_t runs,
+                    int* out, struct pool_t* pool) {
+    assert(pool);
+
+    size_t total = 0;
+    for (size_t i = 0; i < runs; i++) {
+        total += ends[i] - starts[i];
+    }
+
+    size_t slices_count = pool_threads(pool) * SLICES_PER_THREAD;
+    struct merge_slice_t* slices = malloc(slices_count * sizeof(struct merge_slice_t));
+    assert(slices);
+
+    for (size_t i = 0; i < slices_count; i++) {
+        slices[i] = (struct merge_slice_t){array, starts, ends, runs, total, i, slices_count, out};
+        pool_submit(pool, merge_slice, &slices[i]);
+    }
+    pool_wait(pool);
+    free(slices);
+}
@@ -1,50 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
-#include <assert.h>
-#include <unistd.h>
-#include <stdbool.h>
 #include <limits.h>
+#include <time.h>
 
-// M должно быть кратно N
-#define M (16)
-#define N (5)
-
-#define DEBUG
-
-#ifdef DEBUG
-#define DBG_PRINT(...) printf(__VA_ARGS__);
-#else
-#define DBG_PRINT(...)
-#endif
-
-struct monitor_t {
-    pthread_mutex_t mtx;
-    int* array;
-};
-
-struct thread_arg_t {
-    size_t index;
-    struct monitor_t* monitor;
-};
-
-void monitor_init(struct monitor_t* monitor) {
-    assert(monitor);
-
-    pthread_mutex_init(&(monitor->mtx), NULL);
-}
-
-void monitor_destroy(struct monitor_t* monitor) {
-    assert(monitor);
-    pthread_mutex_destroy(&(monitor->mtx));
-}
+#include "mergesort.h"
 
+// разность переполняется на ключах разного знака, поэтому только сравнения
 int comparator(const void* a, const void* b) {
-    return ( (*(int*)a) - (*(int*)b) );
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
 }
 
 void print_int_array(int* array, size_t size) {
+    (void)array;    // без DEBUG печать вырезается целиком
     for (size_t i = 0; i < size; i++) {
         DBG_PRINT("%d ", array[i])
     }
@@ -52,6 +22,7 @@ void print_int_array(int* array, size_t size) {
 }
 
 void print_size_t_array(size_t* array, size_t size) {
+    (void)array;
     for (size_t i = 0; i < size; i++) {
         DBG_PRINT("%ld ", array[i])
     }
@@ -68,166 +39,226 @@ size_t max_size_t(size_t a, size_t b) {
     return res;
 }
 
-void sort_subarray(void* arg) {
-    assert(arg);
-    struct thread_arg_t thread_arg = *(struct thread_arg_t*)arg;
-
-    size_t i = thread_arg.index;
-    struct monitor_t* monitor = thread_arg.monitor;
-
-    size_t size      = (M / N);
-    size_t start_ind = i * (M / N);
-    size_t end_ind   = min_size_t(start_ind + size, M);
-    size = end_ind - start_ind;
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    // последнему может достаться больше !!!
+size_t default_threads() {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (size_t)online : 1;
+}
 
-    int* local_array = monitor->array + start_ind;
+void sort_subarray(int* array, size_t size) {
+    assert(array);
 
     DBG_PRINT("before sorting\n")
-    print_int_array(local_array, size);
+    print_int_array(array, size);
 
-    qsort(local_array, size, sizeof(int), &comparator);
+    sort_ints(array, size);
 
     DBG_PRINT("after sorting\n")
-    print_int_array(local_array, size);
+    print_int_array(array, size);
     DBG_PRINT("=========================================\n")
 }
 
-size_t find_min_in_current_slice(int* array, size_t indices[], size_t ends[]) {
-    assert(array);
+struct sort_ctx_t {
+    int* array;
+    const size_t* starts;
+    const size_t* ends;
+};
 
-    size_t target_ind = 0;
-    int min_val = INT_MAX;
-    bool found = false;
+// Диапазон фрагментов [first_run, last_run), который задача должна отсортировать
+struct sort_task_t {
+    struct sort_ctx_t* ctx;
+    size_t first_run;
+    size_t last_run;
+};
 
-    DBG_PRINT("find min in: ");
-    for (size_t i = 0; i < N; i++) {
-        DBG_PRINT("%d(%ld) ", array[indices[i]], indices[i]);
-    }
-    DBG_PRINT("\n");
-
-    for (size_t i = 0; i < N; i++) {
-        // проверка что еще не вышли из отсортированного фрагмента
-        if (indices[i] < ends[i]) {
-            int temp = array[indices[i]];
-            if (temp < min_val) {
-                min_val = temp;
-                target_ind = i;
-                found = true;
-            }
-        }
-    }
+// Рекурсивное fork-join разбиение: правая половина диапазона уходит в дек пула, где ее
+// может украсть свободный поток, левую задача делит дальше сама, пока не останется
+// один фрагмент. Join - общий pool_wait в parallel_sort
+static void sort_runs_task(struct pool_t* pool, void* arg) {
+    struct sort_task_t* task = arg;
+    struct sort_ctx_t* ctx   = task->ctx;
+
+    while (task->last_run - task->first_run > 1) {
+        size_t mid = task->first_run + (task->last_run - task->first_run) / 2;
 
-    if (!found) return N;  // Все фрагменты закончились
-    return target_ind;
+        struct sort_task_t* right = malloc(sizeof(*right));
+        assert(right);
+        *right = (struct sort_task_t){ctx, mid, task->last_run};
+        pool_submit(pool, sort_runs_task, right);
+
+        task->last_run = mid;
+    }
+    size_t run = task->first_run;
+    sort_subarray(ctx->array + ctx->starts[run], ctx->ends[run] - ctx->starts[run]);
+    free(task);
 }
 
-int* merge(int* array) {
+// Сортирует фрагменты в пуле и сливает их в новый массив; array портится.
+// timing может быть NULL
+int* parallel_sort(int* array, size_t size, struct pool_t* pool, struct sort_timing_t* timing) {
     assert(array);
+    assert(pool);
 
-    size_t indices[N] = {0}; // массив индексов на элементы в отсортированных фрагментах, по одному на фрагмент
-    for (size_t i = 0; i < N; i++) {
-        indices[i] = i * (M / N);
-    }
-    size_t ends[N] = {0};
-    for (size_t i = 0; i < N; i++) {
-        ends[i] = (i+1) * (M / N);
+    size_t runs = min_size_t(pool_threads(pool) * RUNS_PER_THREAD, max_size_t(size, 1));
+
+    size_t* starts = malloc(runs * sizeof(size_t)); // начала отсортированных фрагментов
+    size_t* ends   = malloc(runs * sizeof(size_t));
+    int* new_array = malloc(max_size_t(size, 1) * sizeof(int));
+    assert(starts && ends && new_array);
+    for (size_t i = 0; i < runs; i++) {
+        starts[i] = size * i / runs;
+        ends[i]   = size * (i + 1) / runs;
     }
-    ends[N-1] = max_size_t(ends[N-1], M);
 
     DBG_PRINT("ends indices array:\n");
-    print_size_t_array(ends, N);
+    print_size_t_array(ends, runs);
+
+    double t0 = now_seconds();
 
-    int* new_array = (int*)malloc(M * sizeof(int));
+    struct sort_ctx_t ctx = {array, starts, ends};
+    struct sort_task_t* root = malloc(sizeof(*root));
+    assert(root);
+    *root = (struct sort_task_t){&ctx, 0, runs};
+    pool_submit(pool, sort_runs_task, root);
+    pool_wait(pool);
 
-    for (size_t i = 0; i < M; i++) {
-        // выбираем минимальный элемент из текущих
-        size_t min_ind = find_min_in_current_slice(array, indices, ends);
-        if (min_ind >= N) break;  // Все фрагменты обработаны
+    double t1 = now_seconds();
+
+    DBG_PRINT("before merge:\n");
+    print_int_array(array, size);
+    // финальная стадия сортировки - слияние
+    merge_parallel(array, starts, ends, runs, new_array, pool);
 
-        DBG_PRINT("found min: %d(%ld)\n", array[indices[min_ind]], indices[min_ind]);
-        new_array[i] = array[indices[min_ind]];
-        indices[min_ind]++;
+    double t2 = now_seconds();
+    if (timing != NULL) {
+        *timing = (struct sort_timing_t){runs, t1 - t0, t2 - t1};
     }
 
+    free(starts);
+    free(ends);
     return new_array;
 }
 
+void print_timing(size_t size, const struct pool_t* pool, const struct sort_timing_t* timing) {
+    fprintf(stderr, "%zu elements, %zu threads, %zu runs: sort %.3f s, merge %.3f s\n",
+            size, pool_threads(pool), timing->runs, timing->sort_seconds, timing->merge_seconds);
+}
+
 bool check_sorting(int* array, const size_t size) {
-    int array_cp[size] = {};
-    for (size_t i = 0; i < size; i++) {
-        array_cp[i] = array[i];
-    }
+    int* array_cp = malloc(max_size_t(size, 1) * sizeof(int));
+    assert(array_cp);
+    memcpy(array_cp, array, size * sizeof(int));
 
     qsort(array_cp, size, sizeof(int), comparator);
 
     size_t mismatch_count = 0;
     for (size_t i = 0; i < size; i++) {
         if (array_cp[i] != array[i]) {
-            printf("Mismatch: array_cp[%ld] = %d != %d = array[%ld]\n", i, array_cp[i], array[i], i);
+            fprintf(stderr, "Mismatch: array_cp[%ld] = %d != %d = array[%ld]\n", i, array_cp[i], array[i], i);
             ++mismatch_count;
         }
     }
 
+    free(array_cp);
     return mismatch_count > 0;
 }
 
-int main() {
-
-    int array[M] = {8, 9, 3, 2, 0, 1, 4, 5, 7, 6, 10, 15, 13, 12, 11, 14};
-    pthread_t threads[N];
-    struct monitor_t monitor;
+// Читает не больше limit чисел: int32 в порядке хоста (binary) или числа через пробельные
+// символы. Меньше limit - значит, поток кончился. -1 при ошибке
+long read_ints(FILE* input, bool binary, int* buffer, size_t limit) {
+    assert(input);
+    assert(buffer);
 
-    monitor.array = array;
-    monitor_init(&monitor);
+    size_t count = 0;
+    if (binary) {
+        count = fread(buffer, sizeof(int), limit, input);
+    } else {
+        for (; count < limit; count++) {
+            int scan_res = fscanf(input, "%d", &buffer[count]);
+            if (scan_res == EOF) {
+                break;
+            }
+            if (scan_res != 1) {
+                fprintf(stderr, "mergesort: invalid number in input\n");
+                return -1;
+            }
+        }
+    }
 
-    // подготовим данные для потоков
-    struct thread_arg_t thread_data[N] = {};
-    for (size_t i = 0; i < N; i++) {
-        thread_data[i].index = i;
-        thread_data[i].monitor = &monitor;
+    if (ferror(input)) {
+        perror("Error while reading input");
+        return -1;
     }
-    // сначала потоки частично сортируют массив
-    for (size_t i = 0; i < N; i++) {
+    if (binary && count < limit && getc(input) != EOF) {
+        fprintf(stderr, "mergesort: input size is not a multiple of %zu bytes, tail ignored\n", sizeof(int));
+    }
+    return (long)count;
+}
 
-        if (pthread_create(&threads[i], NULL, sort_subarray, &(thread_data[i])) != 0) {
-            perror("Failed to create thread");
+// Читает весь поток. Возвращает NULL при ошибке, размер массива - в *size
+int* read_input(FILE* input, bool binary, size_t* size) {
+    assert(input);
+    assert(size);
+
+    size_t capacity = INPUT_INITIAL_CAPACITY;
+    size_t count    = 0;
+    int* array = malloc(capacity * sizeof(int));
+    if (array == NULL) {
+        perror("Error in malloc");
+        return NULL;
+    }
 
-            for (size_t j = 0; j < i; j++) {
-                pthread_join(threads[j], NULL);
+    while (true) {
+        if (count == capacity) {
+            capacity *= 2;
+            int* grown = realloc(array, capacity * sizeof(int));
+            if (grown == NULL) {
+                perror("Error in realloc");
+                free(array);
+                return NULL;
             }
+            array = grown;
+        }
 
-            monitor_destroy(&monitor);
-            return 1;
+        long read_count = read_ints(input, binary, array + count, capacity - count);
+        if (read_count < 0) {
+            free(array);
+            return NULL;
+        }
+        count += read_count;
+        if (count < capacity) {
+            break;
         }
     }
+    *size = count;
+    return array;
+}
 
-    // ждем пока потоки завершат работу
-    for (size_t i = 0; i < N; i++) {
-        pthread_join(threads[i], NULL);
-    }
+int write_output(FILE* output, const int* array, size_t size, bool binary) {
+    assert(output);
+    assert(array);
 
-    DBG_PRINT("before merge:\n");
-    print_int_array(monitor.array, M);
-    // финальная стадия сортировки - слияние
-    int* new_array = merge(monitor.array);
-
-    DBG_PRINT("after merge:\n");
-    // проверка сортировки
-    if (check_sorting(new_array, M)) {
-        print_int_array(new_array, M);
-        printf("Sorting failed\n");
-        return false;
+    if (binary) {
+        if (fwrite(array, sizeof(int), size, output) != size) {
+            perror("Error in fwrite");
+            return -1;
+        }
     } else {
-        print_int_array(new_array, M);
-        printf("Sorting succesful\n");
-        return true;
+        for (size_t i = 0; i < size; i++) {
+            if (fprintf(output, "%d\n", array[i]) < 0) {
+                perror("Error in fprintf");
+                return -1;
+            }
+        }
     }
-
-    if (new_array != NULL) {
-        free(new_array);
+    if (fflush(output) != 0) {
+        perror("Error in fflush");
+        return -1;
     }
-    monitor_destroy(&monitor);
     return 0;
 }
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// трассировка печатает каждое сравнение слияния - включать через -DDEBUG
+// #define DEBUG
+
+#ifdef DEBUG
+#define DBG_PRINT(...) printf(__VA_ARGS__);
+#else
+#define DBG_PRINT(...)
+#endif
+
+// сколько отсортированных фрагментов и кусков слияния приходится на поток пула:
+// с запасом, чтобы освободившиеся потоки могли украсть работу у занятых
+#define RUNS_PER_THREAD   4
+#define SLICES_PER_THREAD 4
+
+// до этого размера фрагмент сортируется сетями и слиянием, больше - поразрядно
+#define SMALL_SORT_MAX 256
+
+// внешняя сортировка: меньше такого буфера на фрагмент чтение с диска становится
+// случайным, и фрагменты сначала сливаются группами
+#define EXTERNAL_MIN_BUFFER (1UL << 20)
+
+// дескрипторы, которые внешняя сортировка не занимает фрагментами
+#define EXTERNAL_RESERVED_FDS 16
+
+// начальный размер буфера под входной массив, дальше растет вдвое
+#define INPUT_INITIAL_CAPACITY (1UL << 16)
+
+struct sort_options_t {
+    bool binary;        // вход и выход - сырые int32, иначе числа текстом
+    bool check;         // сверить результат с qsort
+    bool verbose;       // время фаз в stderr
+    size_t threads;
+    size_t memory;      // бюджет памяти внешней сортировки в байтах, 0 - сортировать в памяти
+    const char* tmpdir; // куда сбрасывать отсортированные фрагменты
+
+    // сортировка записей вместо int: фиксированной ширины или строк
+    size_t record_size;
+    bool lines;
+    size_t key_offset;  // ключ - байты [key_offset, key_offset + key_length) записи
+    size_t key_length;  // 0 - до конца записи
+    bool numeric;       // ключ - число: текстом для строк, little-endian для записей
+};
+
+// время фаз parallel_sort: сортировка фрагментов и их слияние
+struct sort_timing_t {
+    size_t runs;
+    double sort_seconds;
+    double merge_seconds;
+};
+
+// пул потоков с деком задач на каждый поток (work stealing)
+struct pool_t;
+
+typedef void (*task_fn_t)(struct pool_t* pool, void* arg);
+
+struct pool_t* pool_create(size_t threads);
+void pool_destroy(struct pool_t* pool);
+void pool_submit(struct pool_t* pool, task_fn_t fn, void* arg);
+void pool_wait(struct pool_t* pool);
+size_t pool_threads(const struct pool_t* pool);
+
+// mergesort.c
+int comparator(const void* a, const void* b);
+void print_int_array(int* array, size_t size);
+void print_size_t_array(size_t* array, size_t size);
+size_t min_size_t(size_t a, size_t b);
+size_t max_size_t(size_t a, size_t b);
+double now_seconds();
+size_t default_threads();
+
+void sort_subarray(int* array, size_t size);
+int* parallel_sort(int* array, size_t size, struct pool_t* pool, struct sort_timing_t* timing);
+void print_timing(size_t size, const struct pool_t* pool, const struct sort_timing_t* timing);
+bool check_sorting(int* array, const size_t size);
+
+long read_ints(FILE* input, bool binary, int* buffer, size_t limit);
+int* read_input(FILE* input, bool binary, size_t* size);
+int write_output(FILE* output, const int* array, size_t size, bool binary);
+
+// sort.c
+void sort_ints(int* array, size_t size);
+
+// external.c
+int external_sort(FILE* input, FILE* output, const struct sort_options_t* options, struct pool_t* pool);
+
+// records.c
+int sort_records(FILE* input, FILE* output, const struct sort_options_t* options, struct pool_t* pool);
+
+// merge.c
+size_t find_min_in_current_slice(const int* array, size_t indices[], const size_t ends[], size_t runs);
+void merge_linear(const int* array, const size_t starts[], const size_t ends[], size_t runs, int* out);
+void merge_runs(const int* array, const size_t starts[], const size_t ends[], size_t runs, int* out);
+void split_runs(const int* array, const size_t starts[], const size_t ends[], size_t runs,
+                size_t rank, size_t splits[]);
+void merge_parallel(const int* array, const size_t starts[], const size_t ends[], size_t runs,
+                    int* out, struct pool_t* pool);
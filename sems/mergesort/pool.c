@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "mergesort.h"
+
+struct task_t {
+    task_fn_t fn;
+    void* arg;
+};
+
+// Дек задач одного потока: владелец кладет и берет с хвоста (LIFO - свежие задачи
+// еще в кэше), воры забирают с головы самые старые и обычно самые крупные задачи
+struct task_deque_t {
+    pthread_mutex_t mtx;
+    struct task_t* tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+};
+
+struct pool_t {
+    size_t threads;     // сколько потоков реально запущено
+    size_t capacity;    // под сколько потоков выделены деки
+    struct task_deque_t* deques;
+    pthread_t* tids;
+
+    // Задачи кладутся и берутся только под мьютексами деков, счетчики атомарные.
+    // Общий мьютекс нужен лишь для сна: поток засыпает, только если после
+    // sleepers += 1 все еще видит queued == 0, а pool_submit будит, если после
+    // queued += 1 видит спящих. Так пробуждение не теряется
+    pthread_mutex_t mtx;
+    pthread_cond_t has_work;
+    pthread_cond_t all_done;
+    atomic_size_t queued;       // задач в деках; растет до вставки, так что не меньше реального
+    atomic_size_t pending;      // задач отправлено и еще не выполнено
+    atomic_size_t sleepers;
+    atomic_size_t next_deque;   // куда класть задачи из потоков вне пула
+    size_t next_worker;         // номер дека для следующего стартующего потока
+    bool stop;                  // под mtx
+};
+
+// какому пулу и деку принадлежит текущий поток: задачи, порожденные внутри задачи,
+// кладутся в свой дек без блокировки чужих
+static __thread struct pool_t* current_pool = NULL;
+static __thread size_t current_worker = 0;
+
+static void deque_init(struct task_deque_t* deque) {
+    pthread_mutex_init(&deque->mtx, NULL);
+    deque->tasks    = NULL;
+    deque->head     = 0;
+    deque->tail     = 0;
+    deque->capacity = 0;
+}
+
+static void deque_destroy(struct task_deque_t* deque) {
+    pthread_mutex_destroy(&deque->mtx);
+    free(deque->tasks);
+}
+
+static void deque_push(struct task_deque_t* deque, struct task_t task) {
+    pthread_mutex_lock(&deque->mtx);
+    if (deque->tail == deque->capacity) {
+        if (deque->head > 0) {
+            // сначала сдвигаем к началу место, освобожденное ворами
+            memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(struct task_t));
+            deque->tail -= deque->head;
+            deque->head  = 0;
+        } else {
+            deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+            deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(struct task_t));
+            assert(deque->tasks);
+        }
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->mtx);
+}
+
+static bool deque_pop(struct task_deque_t* deque, struct task_t* task) {
+    pthread_mutex_lock(&deque->mtx);
+    bool found = deque->head < deque->tail;
+    if (found) {
+        *task = deque->tasks[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->mtx);
+    return found;
+}
+
+static bool deque_steal(struct task_deque_t* deque, struct task_t* task) {
+    pthread_mutex_lock(&deque->mtx);
+    bool found = deque->head < deque->tail;
+    if (found) {
+        *task = deque->tasks[deque->head++];
+    }
+    pthread_mutex_unlock(&deque->mtx);
+    return found;
+}
+
+// Сначала свой дек, потом воруем у соседей по кругу
+static bool pool_take(struct pool_t* pool, size_t self, struct task_t* task) {
+    if (deque_pop(&pool->deques[self], task)) {
+        return true;
+    }
+    for (size_t i = 1; i < pool->threads; i++) {
+        if (deque_steal(&pool->deques[(self + i) % pool->threads], task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* pool_worker(void* arg) {
+    struct pool_t* pool = arg;
+
+    pthread_mutex_lock(&pool->mtx);
+    size_t self = pool->next_worker++;
+    pthread_mutex_unlock(&pool->mtx);
+
+    current_pool   = pool;
+    current_worker = self;
+
+    while (true) {
+        struct task_t task;
+        if (pool_take(pool, self, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.fn(pool, task.arg);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->mtx);
+                pthread_cond_broadcast(&pool->all_done);
+                pthread_mutex_unlock(&pool->mtx);
+            }
+            continue;
+        }
+        if (atomic_load(&pool->queued) > 0) {
+            // задачу учли, но еще не положили в дек или ее уже забрал другой поток
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mtx);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->queued) == 0 && ! pool->stop) {
+            pthread_cond_wait(&pool->has_work, &pool->mtx);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        bool finished = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->mtx);
+        if (finished) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct pool_t* pool_create(size_t threads) {
+    assert(threads > 0);
+
+    struct pool_t* pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->deques = calloc(threads, sizeof(*pool->deques));
+    pool->tids   = calloc(threads, sizeof(*pool->tids));
+    if (pool->deques == NULL || pool->tids == NULL) {
+        free(pool->deques);
+        free(pool->tids);
+        free(pool);
+        return NULL;
+    }
+    pool->capacity = threads;
+    for (size_t i = 0; i < threads; i++) {
+        deque_init(&pool->deques[i]);
+    }
+    pthread_mutex_init(&pool->mtx, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->next_deque, 0);
+
+    // потоки берут номера деков под мьютексом уже после того, как число запущенных
+    // известно: если часть не создалась, работают те, что есть
+    pthread_mutex_lock(&pool->mtx);
+    size_t started = 0;
+    for (; started < threads; started++) {
+        int create_res = pthread_create(&pool->tids[started], NULL, pool_worker, pool);
+        if (create_res != 0) {
+            errno = create_res;
+            perror("Failed to create thread");
+            break;
+        }
+    }
+    pool->threads = started;
+    pthread_mutex_unlock(&pool->mtx);
+
+    if (started == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_destroy(struct pool_t* pool) {
+    assert(pool);
+
+    pthread_mutex_lock(&pool->mtx);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->mtx);
+
+    for (size_t i = 0; i < pool->threads; i++) {
+        pthread_join(pool->tids[i], NULL);
+    }
+    // деки несозданных потоков пусты, но мьютексы у них инициализированы
+    for (size_t i = 0; i < pool->capacity; i++) {
+        deque_destroy(&pool->deques[i]);
+    }
+    pthread_mutex_destroy(&pool->mtx);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_cond_destroy(&pool->all_done);
+    free(pool->deques);
+    free(pool->tids);
+    free(pool);
+}
+
+// Задача попадает в дек вызывающего потока, если он из пула, иначе - по кругу.
+// Счетчики растут до вставки: иначе задачу могли бы выполнить раньше, чем ее учли,
+// и pool_wait увидел бы pending == 0 при еще не выполненной работе
+void pool_submit(struct pool_t* pool, task_fn_t fn, void* arg) {
+    assert(pool);
+    assert(fn);
+
+    struct task_t task = {fn, arg};
+    size_t target = (current_pool == pool) ? current_worker
+                                           : atomic_fetch_add(&pool->next_deque, 1) % pool->threads;
+
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    deque_push(&pool->deques[target], task);
+
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->mtx);
+        pthread_cond_signal(&pool->has_work);
+        pthread_mutex_unlock(&pool->mtx);
+    }
+}
+
+// Ждет все задачи, включая порожденные другими задачами. Вызывать вне потоков пула
+void pool_wait(struct pool_t* pool) {
+    assert(pool);
+    assert(current_pool != pool);
+
+    pthread_mutex_lock(&pool->mtx);
+    while (atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->mtx);
+    }
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+size_t pool_threads(const struct pool_t* pool) {
+    assert(pool);
+    return pool->threads;
+}
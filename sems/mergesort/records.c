@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mergesort.h"
+
+// Запись во время сортировки. Сортируются эти элементы, а не сами записи: prefix -
+// первые 8 байт ключа, упакованные так, что их порядок как uint64 совпадает с порядком
+// ключей. Полные ключи сравниваются только при равных префиксах
+struct record_item_t {
+    uint64_t prefix;
+    const char* key;
+    const char* record;
+    uint32_t key_length;
+    uint32_t record_length;
+};
+
+struct record_set_t {
+    char* data;                 // весь вход
+    struct record_item_t* items;
+    size_t count;
+};
+
+// Префикс числового ключа содержит его целиком (текстовое число - с точностью double),
+// поэтому дальше сравниваются только строковые ключи. Равные ключи упорядочены по положению записи во входе: сортировка устойчива
+static int compare_items(const void* a, const void* b, void* arg) {
+    const struct record_item_t* x = a;
+    const struct record_item_t* y = b;
+    const struct sort_options_t* options = arg;
+
+    if (x->prefix != y->prefix) {
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    if (! options->numeric && (x->key_length > 8 || y->key_length > 8)) {
+        uint32_t common = x->key_length < y->key_length ? x->key_length : y->key_length;
+        int cmp_res = memcmp(x->key, y->key, common);
+        if (cmp_res != 0) {
+            return cmp_res;
+        }
+    }
+    if (! options->numeric && x->key_length != y->key_length) {
+        // префикс дополнен нулями, поэтому "ab" и "ab\0" различает только длина
+        return x->key_length < y->key_length ? -1 : 1;
+    }
+    return (x->record > y->record) - (x->record < y->record);
+}
+
+// Число в начале текстового ключа, как у sort -n в локали C: пробелы, минус, цифры и
+// дробная часть после точки; не число - ноль. Числа, которые различаются только после
+// ~15 значащих цифр, в double совпадают и остаются в порядке входа
+static double parse_text_number(const char* key, size_t length) {
+    size_t i = 0;
+    while (i < length && (key[i] == ' ' || key[i] == '\t')) {
+        i++;
+    }
+    // '+' sort -n, как и здесь, числом не считает
+    bool negative = i < length && key[i] == '-';
+    if (negative) {
+        i++;
+    }
+    double value = 0;
+    for (; i < length && key[i] >= '0' && key[i] <= '9'; i++) {
+        value = value * 10 + (key[i] - '0');
+    }
+    if (i < length && key[i] == '.') {
+        // дробные цифры копятся целым и делятся один раз: так меньше ошибок округления
+        uint64_t fraction = 0;
+        double scale = 1;
+        for (i++; i < length && key[i] >= '0' && key[i] <= '9'; i++) {
+            if (fraction < UINT64_MAX / 10 / 10) {
+                fraction = fraction * 10 + (key[i] - '0');
+                scale *= 10;
+            }
+        }
+        value += fraction / scale;
+    }
+    // -0 и 0 равны, у них должен быть один префикс
+    return negative && value != 0 ? -value : value;
+}
+
+// Целое со знаком в little-endian шириной key_length (1, 2, 4 или 8 байт)
+static int64_t parse_binary_number(const char* key, size_t length) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; i++) {
+        value |= (uint64_t)(unsigned char)key[i] << (8 * i);
+    }
+    // расширение знака из старшего байта ключа
+    if (length < 8 && (value >> (8 * length - 1)) & 1) {
+        value |= ~0ULL << (8 * length);
+    }
+    return (int64_t)value;
+}
+
+static void fill_item(struct record_item_t* item, const char* record, size_t record_length,
+                      const struct sort_options_t* options) {
+    size_t offset = min_size_t(options->key_offset, record_length);
+    size_t length = record_length - offset;
+    if (options->key_length > 0) {
+        length = min_size_t(length, options->key_length);
+    }
+
+    item->record        = record;
+    item->record_length = record_length;
+    item->key           = record + offset;
+    item->key_length    = length;
+
+    if (options->numeric && options->lines) {
+        double value = parse_text_number(item->key, length);
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        // у отрицательных double порядок битов обратный, у положительных хватает знакового бита
+        item->prefix = (bits >> 63) ? ~bits : bits | (1ULL << 63);
+        return;
+    }
+    if (options->numeric) {
+        int64_t value = parse_binary_number(item->key, length);
+        // инверсия знакового бита переводит порядок int64 в порядок uint64
+        item->prefix = (uint64_t)value ^ (1ULL << 63);
+        return;
+    }
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (i < length ? (unsigned char)item->key[i] : 0);
+    }
+    item->prefix = prefix;
+}
+
+static char* read_all(FILE* input, size_t* size) {
+    size_t capacity = INPUT_INITIAL_CAPACITY;
+    size_t used = 0;
+    char* data = malloc(capacity);
+    if (data == NULL) {
+        perror("Error in malloc");
+        return NULL;
+    }
+    while (true) {
+        if (used == capacity) {
+            capacity *= 2;
+            char* grown = realloc(data, capacity);
+            if (grown == NULL) {
+                perror("Error in realloc");
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        size_t read_bytes = fread(data + used, 1, capacity - used, input);
+        used += read_bytes;
+        if (read_bytes == 0) {
+            break;
+        }
+    }
+    if (ferror(input)) {
+        perror("Error while reading input");
+        free(data);
+        return NULL;
+    }
+    *size = used;
+    return data;
+}
+
+static int split_records(struct record_set_t* set, size_t size, const struct sort_options_t* options) {
+    size_t capacity = options->lines ? INPUT_INITIAL_CAPACITY : size / options->record_size;
+    set->items = malloc(max_size_t(capacity, 1) * sizeof(struct record_item_t));
+    if (set->items == NULL) {
+        perror("Error in malloc");
+        return -1;
+    }
+
+    if (! options->lines) {
+        if (size % options->record_size != 0) {
+            fprintf(stderr, "mergesort: input size is not a multiple of %zu bytes, tail ignored\n",
+                    options->record_size);
+        }
+        set->count = capacity;
+        for (size_t i = 0; i < set->count; i++) {
+            fill_item(&set->items[i], set->data + i * options->record_size, options->record_size, options);
+        }
+        return 0;
+    }
+
+    // последняя строка без '\n' - тоже запись
+    set->count = 0;
+    for (char* line = set->data; line < set->data + size; ) {
+        char* newline = memchr(line, '\n', set->data + size - line);
+        size_t length = (newline ? newline : set->data + size) - line;
+        if (set->count == capacity) {
+            capacity *= 2;
+            struct record_item_t* grown = realloc(set->items, capacity * sizeof(struct record_item_t));
+            if (grown == NULL) {
+                perror("Error in realloc");
+                return -1;
+            }
+            set->items = grown;
+        }
+        fill_item(&set->items[set->count++], line, length, options);
+        line += length + 1;
+    }
+    return 0;
+}
+
+struct record_sort_t {
+    struct record_item_t* items;
+    struct record_item_t* tmp;
+    const struct sort_options_t* options;
+};
+
+struct record_run_task_t {
+    struct record_sort_t* sort;
+    size_t start;
+    size_t end;
+};
+
+static void sort_record_run(struct pool_t* pool, void* arg) {
+    (void)pool;
+    struct record_run_task_t* task = arg;
+    qsort_r(task->sort->items + task->start, task->end - task->start, sizeof(struct record_item_t),
+            compare_items, (void*)task->sort->options);
+}
+
+// Кусок [out_lo, out_hi) слияния двух соседних фрагментов
+struct record_merge_task_t {
+    struct record_sort_t* sort;
+    const struct record_item_t* left;
+    size_t left_size;
+    const struct record_item_t* right;
+    size_t right_size;
+    struct record_item_t* out;
+    size_t out_lo;
+    size_t out_hi;
+};
+
+// Merge path для двух фрагментов: сколько элементов левого попадает в первые rank выхода
+static size_t co_rank(const struct record_merge_task_t* task, size_t rank) {
+    size_t lo = rank > task->right_size ? rank - task->right_size : 0;
+    size_t hi = min_size_t(rank, task->left_size);
+    while (lo < hi) {
+        size_t i = lo + (hi - lo) / 2;
+        size_t j = rank - i;
+        // при равенстве первым идет левый, так что left[i] еще должен попасть в выход
+        if (j > 0 && compare_items(&task->right[j - 1], &task->left[i], (void*)task->sort->options) >= 0) {
+            lo = i + 1;
+        } else {
+            hi = i;
+        }
+    }
+    return lo;
+}
+
+static void merge_record_slice(struct pool_t* pool, void* arg) {
+    (void)pool;
+    struct record_merge_task_t* task = arg;
+
+    size_t i     = co_rank(task, task->out_lo);
+    size_t j     = task->out_lo - i;
+    size_t i_end = co_rank(task, task->out_hi);
+    size_t j_end = task->out_hi - i_end;
+
+    struct record_item_t* out = task->out + task->out_lo;
+    while (i < i_end && j < j_end) {
+        if (compare_items(&task->right[j], &task->left[i], (void*)task->sort->options) < 0) {
+            *out++ = task->right[j++];
+        } else {
+            *out++ = task->left[i++];
+        }
+    }
+    memcpy(out, task->left + i, (i_end - i) * sizeof(struct record_item_t));
+    memcpy(out + i_end - i, task->right + j, (j_end - j) * sizeof(struct record_item_t));
+}
+
+// Фрагменты сортируются в пуле, затем попарно сливаются раундами. Каждое попарное
+// слияние режется merge path на куски, так что и последний раунд идет во все потоки
+static struct record_item_t* sort_items(struct record_set_t* set, const struct sort_options_t* options,
+                                        struct pool_t* pool) {
+    size_t count = set->count;
+    size_t runs  = min_size_t(pool_threads(pool) * RUNS_PER_THREAD, max_size_t(count, 1));
+    size_t slices_per_round = pool_threads(pool) * SLICES_PER_THREAD;
+
+    struct record_sort_t sort = {set->items, malloc(max_size_t(count, 1) * sizeof(struct record_item_t)), options};
+    size_t* bounds = malloc((runs + 1) * sizeof(size_t));
+    struct record_run_task_t* run_tasks = malloc(runs * sizeof(struct record_run_task_t));
+    struct record_merge_task_t* merge_tasks = malloc((slices_per_round + runs) * sizeof(struct record_merge_task_t));
+    assert(sort.tmp && bounds && run_tasks && merge_tasks);
+
+    for (size_t i = 0; i <= runs; i++) {
+        bounds[i] = count * i / runs;
+    }
+    for (size_t i = 0; i < runs; i++) {
+        run_tasks[i] = (struct record_run_task_t){&sort, bounds[i], bounds[i + 1]};
+        pool_submit(pool, sort_record_run, &run_tasks[i]);
+    }
+    pool_wait(pool);
+
+    while (runs > 1) {
+        size_t tasks = 0;
+        size_t merged = 0;
+        for (size_t r = 0; r < runs; r += 2) {
+            size_t lo  = bounds[r];
+            size_t mid = bounds[min_size_t(r + 1, runs)];
+            size_t hi  = bounds[min_size_t(r + 2, runs)];
+            // пропорционально размеру пары, но хотя бы один кусок
+            size_t slices = max_size_t(slices_per_round * (hi - lo) / max_size_t(count, 1), 1);
+            for (size_t s = 0; s < slices; s++) {
+                merge_tasks[tasks] = (struct record_merge_task_t){
+                    &sort, sort.items + lo, mid - lo, sort.items + mid, hi - mid,
+                    sort.tmp + lo, (hi - lo) * s / slices, (hi - lo) * (s + 1) / slices,
+                };
+                pool_submit(pool, merge_record_slice, &merge_tasks[tasks++]);
+            }
+            bounds[merged++] = lo;
+        }
+        pool_wait(pool);
+        bounds[merged] = count;
+        runs = merged;
+
+        struct record_item_t* swap = sort.items;
+        sort.items = sort.tmp;
+        sort.tmp   = swap;
+    }
+
+    free(sort.tmp);
+    free(bounds);
+    free(run_tasks);
+    free(merge_tasks);
+    return sort.items;
+}
+
+static int write_records(FILE* output, const struct record_item_t* items, size_t count, bool lines) {
+    for (size_t i = 0; i < count; i++) {
+        if (fwrite(items[i].record, 1, items[i].record_length, output) != items[i].record_length ||
+            (lines && putc('\n', output) == EOF)) {
+            perror("Error while writing output");
+            return -1;
+        }
+    }
+    if (fflush(output) != 0) {
+        perror("Error in fflush");
+        return -1;
+    }
+    return 0;
+}
+
+// Сортировка записей фиксированной ширины (options->record_size) или строк
+// (options->lines) по ключу [key_offset, key_offset + key_length) каждой записи
+int sort_records(FILE* input, FILE* output, const struct sort_options_t* options, struct pool_t* pool) {
+    assert(input);
+    assert(output);
+    assert(options);
+    assert(options->lines || options->record_size > 0);
+
+    struct record_set_t set = {};
+    size_t size = 0;
+    set.data = read_all(input, &size);
+    if (set.data == NULL) {
+        return -1;
+    }
+
+    double t0 = now_seconds();
+    if (split_records(&set, size, options) < 0) {
+        free(set.data);
+        free(set.items);
+        return -1;
+    }
+    double t1 = now_seconds();
+    struct record_item_t* sorted = sort_items(&set, options, pool);
+    double t2 = now_seconds();
+    if (options->verbose) {
+        fprintf(stderr, "%zu records, %zu threads: keys %.3f s, sort %.3f s\n",
+                set.count, pool_threads(pool), t1 - t0, t2 - t1);
+    }
+
+    int res = write_records(output, sorted, set.count, options->lines);
+
+    if (options->check) {
+        size_t mismatch_count = 0;
+        for (size_t i = 1; i < set.count; i++) {
+            if (compare_items(&sorted[i - 1], &sorted[i], (void*)options) > 0) {
+                fprintf(stderr, "Mismatch: record %zu goes before record %zu\n", i - 1, i);
+                ++mismatch_count;
+            }
+        }
+        fprintf(stderr, mismatch_count > 0 ? "Sorting failed\n" : "Sorting succesful\n");
+        res = mismatch_count > 0 ? -1 : res;
+    }
+
+    free(sorted);
+    free(set.data);
+    return res;
+}
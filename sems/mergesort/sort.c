@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mergesort.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SORT_HAVE_X86_SIMD 1
+#endif
+
+// Сортирующая сеть Бэтчера на 8 элементов: 19 компараторов в 6 слоев
+static const unsigned char NETWORK_8[][2] = {
+    {0, 1}, {2, 3}, {4, 5}, {6, 7},
+    {0, 2}, {1, 3}, {4, 6}, {5, 7},
+    {1, 2}, {5, 6}, {0, 4}, {3, 7},
+    {1, 5}, {2, 6},
+    {1, 4}, {3, 6},
+    {2, 4}, {3, 5},
+    {3, 4},
+};
+
+#define NETWORK_8_SIZE (sizeof(NETWORK_8) / sizeof(NETWORK_8[0]))
+
+typedef void (*network_kernel_t)(int* blocks);
+
+// Без ветвлений: компилятор сводит тернарники к cmov, и предсказатель не ошибается на случайных данных
+static void network_8_scalar(int* block) {
+    for (size_t i = 0; i < NETWORK_8_SIZE; i++) {
+        int a = block[NETWORK_8[i][0]];
+        int b = block[NETWORK_8[i][1]];
+        block[NETWORK_8[i][0]] = a < b ? a : b;
+        block[NETWORK_8[i][1]] = a < b ? b : a;
+    }
+}
+
+static void network_8x4_scalar(int* blocks) {
+    for (size_t b = 0; b < 4; b++) {
+        network_8_scalar(blocks + 8 * b);
+    }
+}
+
+#ifdef SORT_HAVE_X86_SIMD
+// Транспонирование 4x4: строки - четыре блока, столбцы - позиции в блоке. Оно же обратное
+#define TRANSPOSE_4x4(r0, r1, r2, r3) do {              \
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);        \
+        __m128i t1 = _mm_unpacklo_epi32(r2, r3);        \
+        __m128i t2 = _mm_unpackhi_epi32(r0, r1);        \
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);        \
+        r0 = _mm_unpacklo_epi64(t0, t1);                \
+        r1 = _mm_unpackhi_epi64(t0, t1);                \
+        r2 = _mm_unpacklo_epi64(t2, t3);                \
+        r3 = _mm_unpackhi_epi64(t2, t3);                \
+    } while (0)
+
+// Четыре блока по 8 сортируются одной сетью: после транспонирования v[j] держит
+// j-й элемент каждого блока, и компаратор - это пара pminsd/pmaxsd на все блоки сразу
+__attribute__((target("sse4.1")))
+static void network_8x4_sse41(int* blocks) {
+    __m128i v[8];
+    for (size_t i = 0; i < 4; i++) {
+        v[i]     = _mm_loadu_si128((const __m128i*)(blocks + 8 * i));
+        v[i + 4] = _mm_loadu_si128((const __m128i*)(blocks + 8 * i + 4));
+    }
+    TRANSPOSE_4x4(v[0], v[1], v[2], v[3]);
+    TRANSPOSE_4x4(v[4], v[5], v[6], v[7]);
+
+    for (size_t i = 0; i < NETWORK_8_SIZE; i++) {
+        __m128i a = v[NETWORK_8[i][0]];
+        __m128i b = v[NETWORK_8[i][1]];
+        v[NETWORK_8[i][0]] = _mm_min_epi32(a, b);
+        v[NETWORK_8[i][1]] = _mm_max_epi32(a, b);
+    }
+
+    TRANSPOSE_4x4(v[0], v[1], v[2], v[3]);
+    TRANSPOSE_4x4(v[4], v[5], v[6], v[7]);
+    for (size_t i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i*)(blocks + 8 * i),     v[i]);
+        _mm_storeu_si128((__m128i*)(blocks + 8 * i + 4), v[i + 4]);
+    }
+}
+#endif
+
+static network_kernel_t network_kernel = network_8x4_scalar;
+static pthread_once_t network_kernel_once = PTHREAD_ONCE_INIT;
+
+static void choose_network_kernel(void) {
+#ifdef SORT_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        network_kernel = network_8x4_sse41;
+    }
+#endif
+}
+
+// Четыре блока по 8 чисел сортируются каждый на месте. sort_ints работает в потоках
+// пула, так что SSE4.1 или скалярная сеть выбирается под pthread_once
+static void network_8x4(int* blocks) {
+    pthread_once(&network_kernel_once, choose_network_kernel);
+    network_kernel(blocks);
+}
+
+static void insertion_sort(int* array, size_t size) {
+    for (size_t i = 1; i < size; i++) {
+        int value = array[i];
+        size_t j = i;
+        for (; j > 0 && array[j - 1] > value; j--) {
+            array[j] = array[j - 1];
+        }
+        array[j] = value;
+    }
+}
+
+static void merge_two(const int* left, size_t left_size, const int* right, size_t right_size, int* out) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < left_size && j < right_size) {
+        *out++ = (right[j] < left[i]) ? right[j++] : left[i++];
+    }
+    memcpy(out, left + i, (left_size - i) * sizeof(int));
+    memcpy(out + left_size - i, right + j, (right_size - j) * sizeof(int));
+}
+
+// Мелкие фрагменты: блоки по 8 сортируются сетью, дальше восходящее слияние через буфер на стеке
+static void small_sort(int* array, size_t size) {
+    assert(size <= SMALL_SORT_MAX);
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        network_8x4(array + i);
+    }
+    for (; i + 8 <= size; i += 8) {
+        network_8_scalar(array + i);
+    }
+    insertion_sort(array + i, size - i);
+
+    int buffer[SMALL_SORT_MAX];
+    int* src = array;
+    int* dst = buffer;
+    for (size_t width = 8; width < size; width *= 2) {
+        for (size_t lo = 0; lo < size; lo += 2 * width) {
+            size_t mid = min_size_t(lo + width, size);
+            size_t hi  = min_size_t(lo + 2 * width, size);
+            merge_two(src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+        }
+        int* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != array) {
+        memcpy(array, src, size * sizeof(int));
+    }
+}
+
+// LSD radix sort по байтам: знаковый бит инвертируется, чтобы отрицательные шли первыми.
+// Гистограммы всех четырех байт считаются за один проход, а байт, одинаковый у всех
+// ключей (частый случай для маленьких чисел), не требует перестановки и пропускается
+static bool radix_sort(int* array, size_t size) {
+    uint32_t* keys = (uint32_t*)array;
+    uint32_t* tmp  = malloc(size * sizeof(uint32_t));
+    if (tmp == NULL) {
+        return false;
+    }
+
+    static const uint32_t SIGN = 0x80000000u;
+    size_t counts[4][256] = {};
+    for (size_t i = 0; i < size; i++) {
+        uint32_t key = keys[i] ^ SIGN;
+        counts[0][key & 0xff]++;
+        counts[1][(key >> 8) & 0xff]++;
+        counts[2][(key >> 16) & 0xff]++;
+        counts[3][key >> 24]++;
+    }
+
+    uint32_t* src = keys;
+    uint32_t* dst = tmp;
+    for (size_t digit = 0; digit < 4; digit++) {
+        unsigned shift = 8 * digit;
+        if (counts[digit][((src[0] ^ SIGN) >> shift) & 0xff] == size) {
+            continue;
+        }
+        size_t offsets[256];
+        size_t sum = 0;
+        for (size_t b = 0; b < 256; b++) {
+            offsets[b] = sum;
+            sum += counts[digit][b];
+        }
+        for (size_t i = 0; i < size; i++) {
+            uint32_t key = src[i];
+            dst[offsets[((key ^ SIGN) >> shift) & 0xff]++] = key;
+        }
+        uint32_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != keys) {
+        memcpy(keys, src, size * sizeof(uint32_t));
+    }
+    free(tmp);
+    return true;
+}
+
+// Специализированная сортировка int вместо qsort: без вызова компаратора по указателю
+void sort_ints(int* array, size_t size) {
+    assert(array);
+
+    if (size <= SMALL_SORT_MAX) {
+        small_sort(array, size);
+    } else if (! radix_sort(array, size)) {
+        // без памяти под буфер поразрядной сортировки обходимся сортировкой на месте
+        qsort(array, size, sizeof(int), comparator);
+    }
+}
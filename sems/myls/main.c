@@ -17,6 +17,8 @@
 #include <fcntl.h>
 #include <stdbool.h>
 
+#include "myls.h"
+
 #ifdef DEBUG
 
 #define DBG_PRINT(...)  printf("%s:%d ", __func__, __LINE__); \
@@ -27,15 +29,6 @@
 
 // const int PATH_MAX = 64;
 
-struct flags_states {
-    bool all;
-    bool directory;
-    bool long_opt;
-    bool inode;
-    bool numeric;
-    bool recursive;
-};
-
 int check_flags(struct flags_states* flags_values, int argc, char *const argv[])
 {
     assert(flags_values != NULL);
@@ -50,7 +43,8 @@ int check_flags(struct flags_states* flags_values, int argc, char *const argv[])
         {"long",        0, 0, 'l'},
         {"inode",       0, 0, 'i'},
         {"numeric",     0, 0, 'n'},
-        {"recursive",   0, 0, 'R'}
+        {"recursive",   0, 0, 'R'},
+        {0,             0, 0,  0 }
     };
     int optidx = 0;
     int n_flags = 0;
@@ -121,12 +115,19 @@ void format_mode(mode_t mode, char* str) {
     str[10] = '\0';
 }
 
-int print_info(const char* full_path, const char* file_name, struct flags_states* fs) {
+// Вызывается из потоков обходчика, поэтому только реентерабельные *_r функции.
+// stat_path - относительно dir_fd (AT_FDCWD для путей из командной строки)
+int print_info(FILE* out, int dir_fd, const char* stat_path, const char* file_name, struct flags_states* fs) {
+    assert(out);
     assert(file_name);
-    assert(full_path);
+    assert(stat_path);
 
-    struct stat file_stat;
-    int stat_result = lstat(full_path, &file_stat);
+    struct stat file_stat = {};
+    int stat_result = 0;
+    // без -l и -i stat не нужен, а на сетевой файловой системе это лишний запрос на файл
+    if (fs->long_opt || fs->inode) {
+        stat_result = fstatat(dir_fd, stat_path, &file_stat, AT_SYMLINK_NOFOLLOW);
+    }
 
     if (fs->long_opt) {
         if (stat_result == -1) {
@@ -135,83 +136,48 @@ int print_info(const char* full_path, const char* file_name, struct flags_states
         }
         char mode_str[11];
         format_mode(file_stat.st_mode, mode_str);
-        printf("%s ", mode_str);
+        fprintf(out, "%s ", mode_str);
 
-        printf("%3lu ", (unsigned long)file_stat.st_nlink);
+        fprintf(out, "%3lu ", (unsigned long)file_stat.st_nlink);
 
-        struct passwd *pwd = getpwuid(file_stat.st_uid);
-        struct group  *grp = getgrgid(file_stat.st_gid);
-        printf("%-8s %-8s ", pwd ? pwd->pw_name : "unknown", grp ? grp->gr_name : "unknown");
+        char name_buf[4096];
+        struct passwd pwd_entry;
+        struct passwd *pwd = NULL;
+        getpwuid_r(file_stat.st_uid, &pwd_entry, name_buf, sizeof(name_buf), &pwd);
+        fprintf(out, "%-8s ", pwd ? pwd->pw_name : "unknown");
+
+        struct group grp_entry;
+        struct group *grp = NULL;
+        getgrgid_r(file_stat.st_gid, &grp_entry, name_buf, sizeof(name_buf), &grp);
+        fprintf(out, "%-8s ", grp ? grp->gr_name : "unknown");
 
         if (S_ISBLK(file_stat.st_mode) || S_ISCHR(file_stat.st_mode)) {
-                printf("%3d, %3d ", major(file_stat.st_rdev), minor(file_stat.st_rdev));
+                fprintf(out, "%3d, %3d ", major(file_stat.st_rdev), minor(file_stat.st_rdev));
         } else {
-            printf("%8lld ", (long long)file_stat.st_size);
+            fprintf(out, "%8lld ", (long long)file_stat.st_size);
         }
 
         time_t now = time(NULL);
-        struct tm *tm_mtime = localtime(&file_stat.st_mtime);
+        struct tm tm_mtime;
+        localtime_r(&file_stat.st_mtime, &tm_mtime);
 
         char time_str[100];
         if (now - file_stat.st_mtime > 6 * 30 * 24 * 60 * 60) {
-            strftime(time_str, sizeof(time_str), "%b %d  %Y", tm_mtime);
+            strftime(time_str, sizeof(time_str), "%b %d  %Y", &tm_mtime);
         } else {
-            strftime(time_str, sizeof(time_str), "%b %d %H:%M", tm_mtime);
+            strftime(time_str, sizeof(time_str), "%b %d %H:%M", &tm_mtime);
         }
-        printf("%s ", time_str);
+        fprintf(out, "%s ", time_str);
     }
     if (fs->inode) {
-        printf("%ld ", (unsigned long)file_stat.st_ino);
-    }
-    printf("%s\n", file_name);
-    return 0;
-}
-
-int print_files_in_dir(const char* dir_path, struct flags_states* fs) {
-    assert(dir_path);
-
-    DIR* d = opendir(dir_path);
-    if (d == NULL) {
-        perror("Could not open current directory");
-        return -1;
-    }
-    struct dirent* e;
-
-    while ( (e = readdir(d)) != NULL) {
-        // пропускаем текущую и родительскую директорию
-        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
-            if (!fs->all || strlen(e->d_name) <= 2) {
-                continue;
-            }
-        }
-        char sub_path[PATH_MAX];
-        // конструируем путь к файлу/папке
-        // и проверка на размер пути
-        if (snprintf(sub_path, sizeof(sub_path), "%s/%s", dir_path, e->d_name) >= (int)sizeof(sub_path)) {
-            fprintf(stderr, "Error: Path too long: %s/%s\n", dir_path, e->d_name);
-            continue;
-        }
-        // рекурсивный обход
-        if (e->d_type == DT_DIR) {
-            print_info(sub_path, e->d_name, fs);
-            if (fs -> recursive) {
-                printf("\n%s:\n", sub_path);
-                print_files_in_dir(sub_path, fs);
-            }
-        }else {
-            // только сами директории без содержимого с этим флагом
-            if (fs->directory) {
-                continue;
-            }
-            print_info(sub_path, e->d_name, fs);
-        }
+        fprintf(out, "%ld ", (unsigned long)file_stat.st_ino);
     }
-    closedir(d);
+    fprintf(out, "%s\n", file_name);
     return 0;
 }
 
 int main(int argc, char* argv[]) {
-    struct flags_states fs;
+    struct flags_states fs = {};
     int n_flags = check_flags(&fs, argc, argv);
 
     if (argc == 1 + n_flags) {
@@ -224,7 +190,7 @@ int main(int argc, char* argv[]) {
             if (S_ISDIR(st.st_mode)) {
                 print_files_in_dir(argv[arg_ind], &fs);
             } else if (S_ISREG(st.st_mode)) {
-                print_info(argv[arg_ind], argv[arg_ind], &fs);
+                print_info(stdout, AT_FDCWD, argv[arg_ind], argv[arg_ind], &fs);
             }
         }
     }
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// обход -R ждет в основном ответов файловой системы, а не процессора,
+// поэтому потоков больше, чем ядер
+#define WALK_THREADS_PER_CPU 4
+
+// дескрипторы, которые обход -R оставляет stdout, stderr и прочим
+#define WALK_RESERVED_FDS 8
+
+// сколько готового, но еще не напечатанного вывода обходчики могут накопить
+#define WALK_MAX_BUFFERED (64UL << 20)
+
+struct flags_states {
+    bool all;
+    bool directory;
+    bool long_opt;
+    bool inode;
+    bool numeric;
+    bool recursive;
+};
+
+// main.c
+int print_info(FILE* out, int dir_fd, const char* stat_path, const char* file_name, struct flags_states* fs);
+
+// walk.c
+int print_files_in_dir(const char* dir_path, struct flags_states* fs);
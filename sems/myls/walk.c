@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "myls.h"
+
+// Открытый каталог, от которого дочерние задачи делают openat и fstatat.
+// Закрывает его тот, кто отпустил последнюю ссылку
+struct dir_handle_t {
+    DIR* dir;
+    atomic_size_t refcount;
+};
+
+struct dir_node_t;
+
+// Вывод каталога - текст вперемешку с выводом подкаталогов: подкаталог печатается
+// целиком сразу после своей строки, как при обходе в глубину в один поток
+struct out_chunk_t {
+    char* text;
+    size_t length;
+    struct dir_node_t* child;
+};
+
+// Узел держат печать (пока не напечатала) и дек (пока задачу не вынули). Печати нужен
+// следующий по порядку каталог: если за него еще никто не взялся, она обходит его сама,
+// а обходчик, вынувший из дека уже взятый узел, просто отпускает его
+struct dir_node_t {
+    struct dir_handle_t* parent;    // NULL - name это путь от cwd (корень или лимит дескрипторов)
+    char* name;
+    char* path;                     // для заголовков и сообщений
+
+    struct out_chunk_t* chunks;
+    size_t chunks_count;
+    size_t chunks_capacity;
+    size_t footprint;               // сколько узел занимает в walker_t.buffered без текста
+    atomic_bool claimed;
+    atomic_size_t refcount;
+    bool done;                      // под walker_t.mtx
+};
+
+// Задача - каталог. Дек на поток: владелец берет свежие задачи с хвоста,
+// свободные потоки воруют самые старые с головы
+struct walk_deque_t {
+    pthread_mutex_t mtx;
+    struct dir_node_t** nodes;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+};
+
+// Деки под своими мьютексами, счетчики атомарные. Общий мьютекс нужен только для сна:
+// поток засыпает, лишь если после sleepers += 1 (throttled += 1) все еще нет работы
+// (буфер полон), а будящий проверяет спящих после того, как изменил счетчик
+struct walker_t {
+    struct flags_states* fs;
+    size_t threads;
+    struct walk_deque_t* deques;
+    pthread_t* tids;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t has_work;
+    pthread_cond_t node_done;
+    pthread_cond_t printed;
+    atomic_size_t queued;           // растет до вставки в дек, так что не меньше реального
+    atomic_size_t sleepers;
+    atomic_size_t next_deque;
+
+    // обходчики не уходят от печати дальше WALK_MAX_BUFFERED байт готового вывода и узлов
+    atomic_size_t buffered;
+    atomic_size_t throttled;
+
+    // открытые каталоги, на которые ссылаются узлы в очереди; сверх max_handles
+    // подкаталоги открываются по полному пути
+    atomic_size_t open_handles;
+    size_t max_handles;
+
+    size_t next_worker;
+    bool stop;                      // под mtx
+};
+
+static __thread size_t current_worker = SIZE_MAX;
+
+static struct dir_handle_t* handle_get(struct dir_handle_t* handle) {
+    atomic_fetch_add(&handle->refcount, 1);
+    return handle;
+}
+
+static void handle_put(struct walker_t* walker, struct dir_handle_t* handle) {
+    if (handle != NULL && atomic_fetch_sub(&handle->refcount, 1) == 1) {
+        closedir(handle->dir);
+        free(handle);
+        atomic_fetch_sub(&walker->open_handles, 1);
+    }
+}
+
+// Будит потоки, ждущие места в буфере, если кто-то из них спит
+static void release_buffered(struct walker_t* walker, size_t size) {
+    atomic_fetch_sub(&walker->buffered, size);
+    if (atomic_load(&walker->throttled) > 0) {
+        pthread_mutex_lock(&walker->mtx);
+        pthread_cond_broadcast(&walker->printed);
+        pthread_mutex_unlock(&walker->mtx);
+    }
+}
+
+static void deque_push(struct walk_deque_t* deque, struct dir_node_t* node) {
+    pthread_mutex_lock(&deque->mtx);
+    if (deque->tail == deque->capacity) {
+        if (deque->head > 0) {
+            memmove(deque->nodes, deque->nodes + deque->head, (deque->tail - deque->head) * sizeof(*deque->nodes));
+            deque->tail -= deque->head;
+            deque->head  = 0;
+        } else {
+            deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+            deque->nodes = realloc(deque->nodes, deque->capacity * sizeof(*deque->nodes));
+            assert(deque->nodes);
+        }
+    }
+    deque->nodes[deque->tail++] = node;
+    pthread_mutex_unlock(&deque->mtx);
+}
+
+static struct dir_node_t* deque_take(struct walk_deque_t* deque, bool steal) {
+    struct dir_node_t* node = NULL;
+    pthread_mutex_lock(&deque->mtx);
+    if (deque->head < deque->tail) {
+        node = steal ? deque->nodes[deque->head++] : deque->nodes[--deque->tail];
+    }
+    pthread_mutex_unlock(&deque->mtx);
+    return node;
+}
+
+static void walker_submit(struct walker_t* walker, struct dir_node_t* node) {
+    size_t target = current_worker != SIZE_MAX ? current_worker
+                                               : atomic_fetch_add(&walker->next_deque, 1) % walker->threads;
+    atomic_fetch_add(&node->refcount, 1);
+    atomic_fetch_add(&walker->queued, 1);
+    deque_push(&walker->deques[target], node);
+
+    if (atomic_load(&walker->sleepers) > 0) {
+        pthread_mutex_lock(&walker->mtx);
+        pthread_cond_signal(&walker->has_work);
+        pthread_mutex_unlock(&walker->mtx);
+    }
+}
+
+static struct dir_node_t* node_new(struct walker_t* walker, struct dir_handle_t* parent,
+                                   const char* name, const char* path) {
+    struct dir_node_t* node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->name = strdup(name);
+    node->path = strdup(path);
+    if (node->name == NULL || node->path == NULL) {
+        free(node->name);
+        free(node->path);
+        free(node);
+        return NULL;
+    }
+    node->parent = parent ? handle_get(parent) : NULL;
+    node->footprint = sizeof(*node) + strlen(name) + strlen(path) + 2;
+    atomic_init(&node->claimed, false);
+    atomic_init(&node->refcount, 1);
+    atomic_fetch_add(&walker->buffered, node->footprint);
+    return node;
+}
+
+// Текст кусков к этому моменту напечатан и освобожден
+static void node_put(struct walker_t* walker, struct dir_node_t* node) {
+    if (atomic_fetch_sub(&node->refcount, 1) != 1) {
+        return;
+    }
+    handle_put(walker, node->parent);
+    size_t footprint = node->footprint;
+    free(node->chunks);
+    free(node->name);
+    free(node->path);
+    free(node);
+    release_buffered(walker, footprint);
+}
+
+static void node_append(struct dir_node_t* node, char* text, size_t length, struct dir_node_t* child) {
+    if (node->chunks_count == node->chunks_capacity) {
+        node->chunks_capacity = node->chunks_capacity ? node->chunks_capacity * 2 : 4;
+        node->chunks = realloc(node->chunks, node->chunks_capacity * sizeof(*node->chunks));
+        assert(node->chunks);
+    }
+    node->chunks[node->chunks_count++] = (struct out_chunk_t){text, length, child};
+}
+
+// Текущий текстовый кусок закрывается перед каждым подкаталогом и в конце каталога
+static void flush_text(struct walker_t* walker, struct dir_node_t* node, FILE** out, char** text, size_t* length) {
+    fclose(*out);
+    if (*length > 0) {
+        node_append(node, *text, *length, NULL);
+        atomic_fetch_add(&walker->buffered, *length);
+    } else {
+        free(*text);
+    }
+    *out = NULL;
+}
+
+static bool is_dir_entry(int dir_fd, const struct dirent* e) {
+    if (e->d_type != DT_UNKNOWN) {
+        return e->d_type == DT_DIR;
+    }
+    // некоторые файловые системы (в том числе сетевые) не заполняют d_type
+    struct stat st;
+    return fstatat(dir_fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+static void list_dir(struct walker_t* walker, struct dir_node_t* node) {
+    struct flags_states* fs = walker->fs;
+
+    int parent_fd = node->parent ? dirfd(node->parent->dir) : AT_FDCWD;
+    int fd = openat(parent_fd, node->name, O_RDONLY | O_DIRECTORY);
+    handle_put(walker, node->parent);
+    node->parent = NULL;
+
+    DIR* d = fd < 0 ? NULL : fdopendir(fd);
+    struct dir_handle_t* handle = d == NULL ? NULL : calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        perror("Could not open current directory");
+        if (d != NULL) {
+            closedir(d);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    handle->dir = d;
+    atomic_init(&handle->refcount, 1);
+    atomic_fetch_add(&walker->open_handles, 1);
+
+    char* text = NULL;
+    size_t length = 0;
+    FILE* out = NULL;
+
+    struct dirent* e;
+    while ( (e = readdir(d)) != NULL) {
+        // пропускаем текущую и родительскую директорию
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            if (!fs->all || strlen(e->d_name) <= 2) {
+                continue;
+            }
+        }
+        if (out == NULL && (out = open_memstream(&text, &length)) == NULL) {
+            perror("Error in open_memstream");
+            break;
+        }
+
+        if (! is_dir_entry(dirfd(d), e)) {
+            // только сами директории без содержимого с этим флагом
+            if (! fs->directory) {
+                print_info(out, dirfd(d), e->d_name, e->d_name, fs);
+            }
+            continue;
+        }
+
+        print_info(out, dirfd(d), e->d_name, e->d_name, fs);
+        if (! fs->recursive) {
+            continue;
+        }
+        size_t path_len = strlen(node->path) + 1 + strlen(e->d_name) + 1;
+        char* sub_path = malloc(path_len);
+        if (sub_path == NULL) {
+            perror("Error in malloc");
+            continue;
+        }
+        snprintf(sub_path, path_len, "%s/%s", node->path, e->d_name);
+        fprintf(out, "\n%s:\n", sub_path);
+
+        // рекурсивный обход - отдельной задачей, вывод встанет на это место. Пока открытых
+        // каталогов меньше лимита, подкаталог откроется через openat от этого; иначе - по
+        // полному пути, и этот каталог закроется сразу после чтения
+        struct dir_node_t* child = atomic_load(&walker->open_handles) < walker->max_handles
+                                       ? node_new(walker, handle, e->d_name, sub_path)
+                                       : node_new(walker, NULL, sub_path, sub_path);
+        free(sub_path);
+        if (child == NULL) {
+            perror("Error in malloc");
+            continue;
+        }
+        flush_text(walker, node, &out, &text, &length);
+        node_append(node, NULL, 0, child);
+        walker_submit(walker, child);
+    }
+    if (out != NULL) {
+        flush_text(walker, node, &out, &text, &length);
+    }
+    handle_put(walker, handle);
+}
+
+// Пока печать отстает больше чем на WALK_MAX_BUFFERED, новые каталоги не начинаем
+static void wait_for_printer(struct walker_t* walker) {
+    if (atomic_load(&walker->buffered) < WALK_MAX_BUFFERED) {
+        return;
+    }
+    pthread_mutex_lock(&walker->mtx);
+    atomic_fetch_add(&walker->throttled, 1);
+    while (atomic_load(&walker->buffered) >= WALK_MAX_BUFFERED && ! walker->stop) {
+        pthread_cond_wait(&walker->printed, &walker->mtx);
+    }
+    atomic_fetch_sub(&walker->throttled, 1);
+    pthread_mutex_unlock(&walker->mtx);
+}
+
+// Сначала свой дек, потом воруем у соседей по кругу
+static struct dir_node_t* walker_take(struct walker_t* walker, size_t self) {
+    struct dir_node_t* node = deque_take(&walker->deques[self], false);
+    for (size_t i = 1; node == NULL && i < walker->threads; i++) {
+        node = deque_take(&walker->deques[(self + i) % walker->threads], true);
+    }
+    if (node != NULL) {
+        atomic_fetch_sub(&walker->queued, 1);
+    }
+    return node;
+}
+
+static void* walk_worker(void* arg) {
+    struct walker_t* walker = arg;
+
+    pthread_mutex_lock(&walker->mtx);
+    size_t self = walker->next_worker++;
+    pthread_mutex_unlock(&walker->mtx);
+    current_worker = self;
+
+    while (true) {
+        wait_for_printer(walker);
+
+        struct dir_node_t* node = walker_take(walker, self);
+        if (node != NULL) {
+            // узел мог уже забрать поток печати
+            if (! atomic_exchange(&node->claimed, true)) {
+                list_dir(walker, node);
+                pthread_mutex_lock(&walker->mtx);
+                node->done = true;
+                pthread_cond_broadcast(&walker->node_done);
+                pthread_mutex_unlock(&walker->mtx);
+            }
+            node_put(walker, node);
+            continue;
+        }
+        if (atomic_load(&walker->queued) > 0) {
+            // задачу учли, но еще не положили в дек или ее уже вынул другой поток
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&walker->mtx);
+        atomic_fetch_add(&walker->sleepers, 1);
+        while (atomic_load(&walker->queued) == 0 && ! walker->stop) {
+            pthread_cond_wait(&walker->has_work, &walker->mtx);
+        }
+        atomic_fetch_sub(&walker->sleepers, 1);
+        bool finished = walker->stop && atomic_load(&walker->queued) == 0;
+        pthread_mutex_unlock(&walker->mtx);
+        if (finished) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Печать в порядке однопоточного обхода: берем готовый каталог (или обходим его сами,
+// если за него еще никто не взялся), печатаем его текст, а на месте подкаталога -
+// рекурсивно его вывод. Напечатанное сразу освобождается, так что в памяти держится
+// только то, что обходчики успели сделать впрок, не больше WALK_MAX_BUFFERED
+static void print_node(struct walker_t* walker, struct dir_node_t* node) {
+    if (! atomic_exchange(&node->claimed, true)) {
+        list_dir(walker, node);
+    } else {
+        pthread_mutex_lock(&walker->mtx);
+        while (! node->done) {
+            pthread_cond_wait(&walker->node_done, &walker->mtx);
+        }
+        pthread_mutex_unlock(&walker->mtx);
+    }
+
+    for (size_t i = 0; i < node->chunks_count; i++) {
+        struct out_chunk_t* chunk = &node->chunks[i];
+        if (chunk->child != NULL) {
+            print_node(walker, chunk->child);
+        } else {
+            fwrite(chunk->text, 1, chunk->length, stdout);
+            free(chunk->text);
+            release_buffered(walker, chunk->length);
+        }
+    }
+    node_put(walker, node);
+}
+
+// Дескрипторы, которые обход может занять каталогами: лимит без стандартных потоков и запаса
+static size_t walk_fd_budget() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return SIZE_MAX / 4;
+    }
+    return limit.rlim_cur > WALK_RESERVED_FDS + 4 ? limit.rlim_cur - WALK_RESERVED_FDS : 4;
+}
+
+// Каждый поток (и поток печати) держит открытым каталог, который читает, поэтому
+// потоков не больше четверти бюджета; остальное - под каталоги для openat
+static size_t walk_threads_count(struct flags_states* fs, size_t fd_budget) {
+    // без -R каталог один, и потоки ему не помогут
+    if (! fs->recursive) {
+        return 1;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = (online > 0 ? (size_t)online : 1) * WALK_THREADS_PER_CPU;
+    size_t fd_threads = fd_budget / 4 > 0 ? fd_budget / 4 : 1;
+    return threads < fd_threads ? threads : fd_threads;
+}
+
+int print_files_in_dir(const char* dir_path, struct flags_states* fs) {
+    assert(dir_path);
+    assert(fs);
+
+    size_t fd_budget = walk_fd_budget();
+    size_t threads = walk_threads_count(fs, fd_budget);
+    struct walker_t walker = {.fs = fs};
+    // сверх лимита каждый читающий поток (и печать) открывает еще по каталогу, а гонка
+    // проверки лимита дает еще столько же
+    walker.max_handles = fd_budget > 2 * (threads + 1) ? fd_budget - 2 * (threads + 1) : 0;
+    atomic_init(&walker.queued, 0);
+    atomic_init(&walker.sleepers, 0);
+    atomic_init(&walker.next_deque, 0);
+    atomic_init(&walker.buffered, 0);
+    atomic_init(&walker.throttled, 0);
+    atomic_init(&walker.open_handles, 0);
+
+    walker.deques = calloc(threads, sizeof(*walker.deques));
+    walker.tids   = calloc(threads, sizeof(*walker.tids));
+    struct dir_node_t* root = node_new(&walker, NULL, dir_path, dir_path);
+    if (walker.deques == NULL || walker.tids == NULL || root == NULL) {
+        perror("Error in calloc");
+        free(walker.deques);
+        free(walker.tids);
+        if (root != NULL) {
+            free(root->name);
+            free(root->path);
+            free(root);
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_mutex_init(&walker.deques[i].mtx, NULL);
+    }
+    pthread_mutex_init(&walker.mtx, NULL);
+    pthread_cond_init(&walker.has_work, NULL);
+    pthread_cond_init(&walker.node_done, NULL);
+    pthread_cond_init(&walker.printed, NULL);
+
+    // номера деков потоки берут под мьютексом, когда число запущенных уже известно
+    pthread_mutex_lock(&walker.mtx);
+    size_t started = 0;
+    for (; started < threads; started++) {
+        int create_res = pthread_create(&walker.tids[started], NULL, walk_worker, &walker);
+        if (create_res != 0) {
+            errno = create_res;
+            perror("Error in pthread_create");
+            break;
+        }
+    }
+    // без пула все каталоги по очереди обойдет поток печати, задачи копятся в деке 0
+    walker.threads = started > 0 ? started : 1;
+    pthread_mutex_unlock(&walker.mtx);
+
+    walker_submit(&walker, root);
+    print_node(&walker, root);
+
+    pthread_mutex_lock(&walker.mtx);
+    walker.stop = true;
+    pthread_cond_broadcast(&walker.has_work);
+    pthread_cond_broadcast(&walker.printed);
+    pthread_mutex_unlock(&walker.mtx);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(walker.tids[i], NULL);
+    }
+
+    // в деках могут остаться только узлы, которые уже обошел поток печати
+    for (size_t i = 0; i < threads; i++) {
+        struct dir_node_t* node = NULL;
+        while ((node = deque_take(&walker.deques[i], false)) != NULL) {
+            node_put(&walker, node);
+        }
+        pthread_mutex_destroy(&walker.deques[i].mtx);
+        free(walker.deques[i].nodes);
+    }
+    pthread_mutex_destroy(&walker.mtx);
+    pthread_cond_destroy(&walker.has_work);
+    pthread_cond_destroy(&walker.node_done);
+    pthread_cond_destroy(&walker.printed);
+    free(walker.deques);
+    free(walker.tids);
+    return 0;
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -8,7 +10,24 @@
 #include <ctype.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/epoll.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WC_HAVE_X86_SIMD 1
+#endif
 
 
 #define DBG_PRINT(...)  printf("%s:%d ", __func__, __LINE__); \
@@ -16,14 +35,57 @@
 
 #define HARD_CHECK(cond, msg) if ( (int)(cond) < 0) { perror(msg); exit(EXIT_FAILURE); }
 
-#define BUFFER_SIZE (4)
+#define BUFFER_SIZE (64 * 1024)
 
 typedef struct {
     size_t bytes;
     size_t words;
     size_t lines;
+    bool in_word;       // последний прочитанный байт был частью слова - слово может продолжиться в следующем read
 } wc_ctx_t;
 
+// Один поток вывода дочернего процесса
+typedef struct {
+    int fd;                 // читающий конец pipe
+    int forward_fd;         // куда пересылать прочитанное (--tee), -1 - никуда
+    bool forward_pipe;      // forward_fd - pipe, и данные можно дублировать через tee()
+    const char* name;
+    wc_ctx_t info;
+    wc_ctx_t last_report;   // счетчики на момент прошлого --interval отчета
+} wc_stream_t;
+
+// Команда и два ее потока. Команды в argv разделяются "--"
+typedef struct {
+    char** argv;
+    pid_t pid;
+    wc_stream_t streams[2];     // STDOUT, STDERR
+
+    // заполняется wait4() при сборе ребенка
+    bool reaped;
+    int status;
+    struct rusage usage;
+    double started;             // CLOCK_MONOTONIC
+    double finished;
+} wc_command_t;
+
+#define COMMAND_SEPARATOR "--"
+
+// --files: файл режется на куски по FILE_CHUNK_SIZE, куски раздаются потокам
+#define FILE_CHUNK_SIZE ((size_t)16 << 20)
+
+// Один отображенный в память файл, который несколько потоков считают по кускам
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t chunks_count;
+    atomic_size_t next_chunk;
+} wc_file_job_t;
+
+typedef struct {
+    wc_file_job_t* job;
+    wc_ctx_t partial;
+} wc_file_worker_t;
+
 
 ssize_t safewrite(int fd, const void* buffer, size_t size) {
     assert(buffer);
@@ -58,29 +120,15 @@ ssize_t saferead(int fd, void* buffer, size_t size) {
     return read_total;
 }
 
-int count(int fd_from, wc_ctx_t* info)
-{
-    DBG_PRINT("\n");
-    bool in_word = false;
-    char buffer[BUFFER_SIZE];
-    // while (true)
-    // {
-    DBG_PRINT("\n");
-    // не знаем, сколько нужно прочитать, читаем кусками по BUFFER_SIZE
-    ssize_t read_bytes = read(fd_from, buffer, BUFFER_SIZE);
-    // HARD_CHECK(read_bytes, "Reading error");
-    if (read_bytes == 0) {
-        DBG_PRINT("file end\n");
-        return 0;
-    }
-    if (read_bytes < 0) {
-        perror("read");
-        return -1;
-    }
+// Ядро подсчета. in_word - состояние на входе в блок (был ли предыдущий байт частью слова),
+// на выходе - состояние после последнего байта. Пробельные байты - ровно те, что isspace()
+// считает пробелами в локали "C": ' ', '\t', '\n', '\v', '\f', '\r'.
+typedef void (*count_kernel_t)(const unsigned char* buffer, size_t size, bool* in_word, wc_ctx_t* info);
 
-    DBG_PRINT("read success\n");
-    info->bytes += read_bytes;
-    for (ssize_t i = 0; i < read_bytes; ++i)
+static void count_block_scalar(const unsigned char* buffer, size_t size, bool* in_word, wc_ctx_t* info)
+{
+    bool word = *in_word;
+    for (size_t i = 0; i < size; ++i)
     {
         if (buffer[i] == '\n')
         {
@@ -88,128 +136,777 @@ int count(int fd_from, wc_ctx_t* info)
         }
         if (!isspace(buffer[i]))
         {
-            if (!in_word)
+            if (!word)
             {
                 info->words++;
-                in_word = true;
+                word = true;
             }
         } else
         {
-            in_word = false;
+            word = false;
+        }
+    }
+    *in_word = word;
+}
+
+#ifdef WC_HAVE_X86_SIMD
+// Векторные версии строят по блоку битовые маски "перевод строки" и "пробел".
+// Начало слова - непробельный байт, перед которым стоит пробельный; бит для байта
+// перед блоком берется из in_word, поэтому результат совпадает со скалярным до бита
+
+__attribute__((target("sse2")))
+static void count_block_sse2(const unsigned char* buffer, size_t size, bool* in_word, wc_ctx_t* info)
+{
+    const __m128i newline   = _mm_set1_epi8('\n');
+    const __m128i blank     = _mm_set1_epi8(' ');
+    const __m128i tab       = _mm_set1_epi8('\t');
+    const __m128i ctrl_span = _mm_set1_epi8('\r' - '\t');
+
+    uint32_t prev_space = ! *in_word;
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buffer + i));
+        // '\t'..'\r' идут подряд: (v - '\t') <= 4 как беззнаковое
+        __m128i shifted  = _mm_sub_epi8(v, tab);
+        __m128i is_ctrl  = _mm_cmpeq_epi8(_mm_min_epu8(shifted, ctrl_span), shifted);
+        __m128i is_space = _mm_or_si128(is_ctrl, _mm_cmpeq_epi8(v, blank));
+
+        uint32_t nl_mask    = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        uint32_t space_mask = (uint32_t)_mm_movemask_epi8(is_space);
+        uint32_t starts     = ~space_mask & ((space_mask << 1) | prev_space) & 0xffffu;
+
+        info->lines += __builtin_popcount(nl_mask);
+        info->words += __builtin_popcount(starts);
+        prev_space = (space_mask >> 15) & 1;
+    }
+    *in_word = ! prev_space;
+    count_block_scalar(buffer + i, size - i, in_word, info);
+}
+
+__attribute__((target("avx2")))
+static void count_block_avx2(const unsigned char* buffer, size_t size, bool* in_word, wc_ctx_t* info)
+{
+    const __m256i newline   = _mm256_set1_epi8('\n');
+    const __m256i blank     = _mm256_set1_epi8(' ');
+    const __m256i tab       = _mm256_set1_epi8('\t');
+    const __m256i ctrl_span = _mm256_set1_epi8('\r' - '\t');
+
+    uint64_t prev_space = ! *in_word;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        __m256i shifted  = _mm256_sub_epi8(v, tab);
+        __m256i is_ctrl  = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, ctrl_span), shifted);
+        __m256i is_space = _mm256_or_si256(is_ctrl, _mm256_cmpeq_epi8(v, blank));
+
+        uint64_t nl_mask    = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        uint64_t space_mask = (uint32_t)_mm256_movemask_epi8(is_space);
+        uint64_t starts     = ~space_mask & ((space_mask << 1) | prev_space) & 0xffffffffu;
+
+        info->lines += __builtin_popcountll(nl_mask);
+        info->words += __builtin_popcountll(starts);
+        prev_space = (space_mask >> 31) & 1;
+    }
+    *in_word = ! prev_space;
+    count_block_sse2(buffer + i, size - i, in_word, info);
+}
+#endif
+
+static count_kernel_t count_kernel = count_block_scalar;
+static pthread_once_t count_kernel_once = PTHREAD_ONCE_INIT;
+
+static void choose_count_kernel(void)
+{
+#ifdef WC_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        count_kernel = count_block_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        count_kernel = count_block_sse2;
+    }
+#endif
+}
+
+// Ядро под процессор выбирается один раз; count_block зовут и потоки --files,
+// поэтому выбор идет через pthread_once, а не через ленивую static-переменную
+void count_block(const unsigned char* buffer, size_t size, bool* in_word, wc_ctx_t* info)
+{
+    pthread_once(&count_kernel_once, choose_count_kernel);
+    count_kernel(buffer, size, in_word, info);
+}
+
+// Забирает из pipe ровно size байт, которые tee() уже переслал дальше, и считает их
+static int consume_teed(wc_stream_t* stream, char* buffer, size_t size)
+{
+    size_t consumed = 0;
+    while (consumed < size) {
+        ssize_t read_bytes = read(stream->fd, buffer, size - consumed);
+        if (read_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes <= 0) {
+            perror("read after tee");
+            return -1;
+        }
+        stream->info.bytes += read_bytes;
+        count_block((const unsigned char*)buffer, read_bytes, &stream->info.in_word, &stream->info);
+        consumed += read_bytes;
+    }
+    return 0;
+}
+
+// Вычитывает из неблокирующего fd все, что уже есть, до EAGAIN, и при --tee
+// пересылает прочитанное в forward_fd. Если forward_fd - pipe, данные дублируются
+// через tee() внутри ядра, а read нужен только для подсчета.
+// Возвращает 1, если поток еще открыт, 0 на EOF и -1 при ошибке
+int count(wc_stream_t* stream)
+{
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        if (stream->forward_pipe) {
+            ssize_t teed = tee(stream->fd, stream->forward_fd, BUFFER_SIZE, SPLICE_F_NONBLOCK);
+            if (teed > 0) {
+                if (consume_teed(stream, buffer, teed) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            if (teed == 0) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                // например, EINVAL: ядро не умеет tee между этими pipe
+                stream->forward_pipe = false;
+            }
+            // EAGAIN: либо читать нечего, либо приемник переполнен -
+            // это различит обычный read ниже, а запись в приемник подождет
+        }
+
+        ssize_t read_bytes = read(stream->fd, buffer, BUFFER_SIZE);
+        if (read_bytes == 0) {
+            return 0;
+        }
+        if (read_bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            perror("read");
+            return -1;
+        }
+
+        stream->info.bytes += read_bytes;
+        count_block((const unsigned char*)buffer, read_bytes, &stream->info.in_word, &stream->info);
+        if (stream->forward_fd >= 0 && safewrite(stream->forward_fd, buffer, read_bytes) < 0) {
+            return -1;
         }
     }
-    // safewrite(fd_to, buffer, read_bytes);
-    // }
+}
 
-    DBG_PRINT("info->bytes: %ld\n", info->bytes);
-    return read_bytes;
+static bool is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
 }
 
-void dump_wc_info(wc_ctx_t* info, const char* msg) {
+int set_nonblocking(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    if (fl < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+void dump_wc_info(FILE* out, wc_ctx_t* info, const char* msg) {
+    assert(out);
     assert(msg);
     assert(info);
 
-    printf("%s\n", msg);
-    printf("bytes: %ld\n", info->bytes);
-    printf("words: %ld\n", info->words);
-    printf("lines: %ld\n", info->lines);
+    fprintf(out, "%s\n", msg);
+    fprintf(out, "bytes: %ld\n", info->bytes);
+    fprintf(out, "words: %ld\n", info->words);
+    fprintf(out, "lines: %ld\n", info->lines);
 }
 
-int main(int argc, char* const* argv) {
+void add_wc_info(wc_ctx_t* total, const wc_ctx_t* info) {
+    assert(total);
+    assert(info);
 
-    if (argc < 2) {
-        perror("too few arguments");
-        return EXIT_FAILURE;
+    total->bytes += info->bytes;
+    total->words += info->words;
+    total->lines += info->lines;
+}
+
+// Разбивает argv на команды по "--". Возвращает число команд или -1.
+// Массивы argv команд завершаются NULL, как того требует execvp
+int split_commands(int argc, char** argv, wc_command_t** commands) {
+    int commands_count = 1;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], COMMAND_SEPARATOR) == 0) {
+            commands_count++;
+        }
+    }
+    *commands = calloc(commands_count, sizeof(wc_command_t));
+    char** args = calloc(argc + commands_count, sizeof(char*));
+    if (*commands == NULL || args == NULL) {
+        free(*commands);
+        free(args);
+        return -1;
+    }
+
+    int cmd = 0;
+    (*commands)[0].argv = args;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], COMMAND_SEPARATOR) == 0) {
+            *args++ = NULL;
+            (*commands)[++cmd].argv = args;
+        } else {
+            *args++ = argv[i];
+        }
+    }
+    *args = NULL;
+
+    for (int i = 0; i < commands_count; i++) {
+        if ((*commands)[i].argv[0] == NULL) {
+            fprintf(stderr, "empty command #%d\n", i + 1);
+            free((*commands)[0].argv);
+            free(*commands);
+            return -1;
+        }
     }
+    return commands_count;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Запускает команду с stdout/stderr, направленными в новые pipe.
+// Читающие концы создаются с O_CLOEXEC, чтобы следующие дети их не унаследовали
+int spawn_command(wc_command_t* command) {
     int STDOUT_pipefds[2];
     int STDERR_pipefds[2];
 
-    if (pipe(STDOUT_pipefds) != 0)
+    if (pipe2(STDOUT_pipefds, O_CLOEXEC) != 0)
     {
         perror("STDOUT pipe");
-        return EXIT_FAILURE;
+        return -1;
     }
-    if (pipe(STDERR_pipefds) != 0)
+    if (pipe2(STDERR_pipefds, O_CLOEXEC) != 0)
     {
         perror("STDERR pipe");
-        return EXIT_FAILURE;
+        close(STDOUT_pipefds[0]);
+        close(STDOUT_pipefds[1]);
+        return -1;
     }
 
+    command->started = now_seconds();
     pid_t pid = fork();
     if (pid == 0) {
-        close(STDOUT_pipefds[0]);                  // Closing read ds for child
-        dup2(STDOUT_pipefds[1], STDOUT_FILENO);    // Dupping write fd to stdout (1)
-        close(STDOUT_pipefds[1]);                  // Closing write fd
+        // SIGCHLD у родителя заблокирован ради signalfd, ребенку это не нужно
+        sigset_t child_mask;
+        sigemptyset(&child_mask);
+        sigprocmask(SIG_SETMASK, &child_mask, NULL);
 
-        close(STDERR_pipefds[0]);
+        dup2(STDOUT_pipefds[1], STDOUT_FILENO);    // Dupping write fd to stdout (1), dup2 снимает O_CLOEXEC
         dup2(STDERR_pipefds[1], STDERR_FILENO);
-        close(STDERR_pipefds[1]);
-
-        execvp(argv[1], argv + 1);
 
-        return 0;
+        execvp(command->argv[0], command->argv);
+        perror("execvp");
+        _exit(EXIT_FAILURE);
     }
     close(STDOUT_pipefds[1]);
     close(STDERR_pipefds[1]);  // Closing write fd for parent
+    if (pid < 0) {
+        perror("fork");
+        close(STDOUT_pipefds[0]);
+        close(STDERR_pipefds[0]);
+        return -1;
+    }
 
-    // собираем данные
-    int fd_out = STDOUT_pipefds[0];
-    int fd_err = STDERR_pipefds[0];
+    command->pid = pid;
+    command->streams[0] = (wc_stream_t){.fd = STDOUT_pipefds[0], .forward_fd = -1, .name = "STDOUT"};
+    command->streams[1] = (wc_stream_t){.fd = STDERR_pipefds[0], .forward_fd = -1, .name = "STDERR"};
+    return 0;
+}
+
+// Собирает ребенка через wait4, чтобы получить его rusage.
+// С WNOHANG ничего не ждет, если этот ребенок еще жив
+void reap_command(wc_command_t* command, int options) {
+    if (command->reaped) {
+        return;
+    }
+    pid_t pid;
+    while ((pid = wait4(command->pid, &command->status, options, &command->usage)) < 0 && errno == EINTR) {}
+    if (pid == command->pid) {
+        command->reaped   = true;
+        command->finished = now_seconds();
+    }
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int exit_code(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+void dump_usage(FILE* out, const wc_command_t* command) {
+    assert(out);
+    assert(command);
+
+    if (!command->reaped) {
+        fprintf(out, "resources: not available\n");
+        return;
+    }
+    const struct rusage* ru = &command->usage;
+    fprintf(out, "exit code: %d\n", exit_code(command->status));
+    fprintf(out, "wall time: %.3f s\n", command->finished - command->started);
+    fprintf(out, "user time: %.3f s\n", timeval_seconds(ru->ru_utime));
+    fprintf(out, "sys time: %.3f s\n", timeval_seconds(ru->ru_stime));
+    fprintf(out, "max rss: %ld KB\n", ru->ru_maxrss);
+    fprintf(out, "context switches: %ld voluntary, %ld involuntary\n", ru->ru_nvcsw, ru->ru_nivcsw);
+    fprintf(out, "page faults: %ld minor, %ld major\n", ru->ru_minflt, ru->ru_majflt);
+}
+
+static void json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (; *str != '\0'; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void json_counts(FILE* out, const wc_ctx_t* info) {
+    fprintf(out, "{\"bytes\": %zu, \"words\": %zu, \"lines\": %zu}", info->bytes, info->words, info->lines);
+}
+
+// Весь отчет одним JSON-объектом: {"commands": [...], "total": {...}}
+void dump_json(FILE* out, const wc_command_t* commands, int commands_count) {
+    wc_ctx_t total_stdout = {};
+    wc_ctx_t total_stderr = {};
+
+    fprintf(out, "{\"commands\": [");
+    for (int cmd = 0; cmd < commands_count; cmd++) {
+        const wc_command_t* command = &commands[cmd];
+        fprintf(out, "%s{\"argv\": [", cmd == 0 ? "" : ", ");
+        for (char** arg = command->argv; *arg != NULL; arg++) {
+            if (arg != command->argv) {
+                fprintf(out, ", ");
+            }
+            json_string(out, *arg);
+        }
+        fprintf(out, "], \"stdout\": ");
+        json_counts(out, &command->streams[0].info);
+        fprintf(out, ", \"stderr\": ");
+        json_counts(out, &command->streams[1].info);
+
+        if (command->reaped) {
+            const struct rusage* ru = &command->usage;
+            fprintf(out, ", \"exit_code\": %d, \"wall_s\": %.6f, \"user_s\": %.6f, \"sys_s\": %.6f, "
+                         "\"max_rss_kb\": %ld, \"voluntary_ctx_switches\": %ld, \"involuntary_ctx_switches\": %ld, "
+                         "\"minor_faults\": %ld, \"major_faults\": %ld",
+                    exit_code(command->status), command->finished - command->started,
+                    timeval_seconds(ru->ru_utime), timeval_seconds(ru->ru_stime), ru->ru_maxrss,
+                    ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt);
+        }
+        fprintf(out, "}");
+        add_wc_info(&total_stdout, &command->streams[0].info);
+        add_wc_info(&total_stderr, &command->streams[1].info);
+    }
+    fprintf(out, "], \"total\": {\"stdout\": ");
+    json_counts(out, &total_stdout);
+    fprintf(out, ", \"stderr\": ");
+    json_counts(out, &total_stderr);
+    fprintf(out, "}}\n");
+}
+
+// timerfd с периодом interval секунд; его срабатывания приходят в тот же epoll, что и pipe
+int create_interval_timer(double interval) {
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0) {
+        return -1;
+    }
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec  = (time_t)interval;
+    spec.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+    if (spec.it_interval.tv_sec == 0 && spec.it_interval.tv_nsec == 0) {
+        spec.it_interval.tv_nsec = 1;   // нулевой период выключил бы таймер
+    }
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(tfd, 0, &spec, NULL) < 0) {
+        close(tfd);
+        return -1;
+    }
+    return tfd;
+}
+
+// Промежуточный отчет: накопленные счетчики и скорость с прошлого отчета
+void dump_rates(FILE* out, wc_command_t* commands, int commands_count, double elapsed, double period) {
+    for (int cmd = 0; cmd < commands_count; cmd++) {
+        for (int i = 0; i < 2; i++) {
+            wc_stream_t* stream = &commands[cmd].streams[i];
+            size_t bytes = stream->info.bytes - stream->last_report.bytes;
+            size_t lines = stream->info.lines - stream->last_report.lines;
+
+            fprintf(out, "[%.1fs] #%d %s %s: bytes: %zu (%.0f B/s) words: %zu lines: %zu (%.1f lines/s)\n",
+                    elapsed, cmd + 1, commands[cmd].argv[0], stream->name,
+                    stream->info.bytes, bytes / period, stream->info.words,
+                    stream->info.lines, lines / period);
+            stream->last_report = stream->info;
+        }
+    }
+    fflush(out);
+}
+
+// Кусок считается независимо от соседей: состояние in_word на входе берется
+// из последнего байта предыдущего куска, который виден через mmap. Так слово,
+// разрезанное границей кусков, засчитывается только тому куску, где оно началось
+static void count_chunk(const wc_file_job_t* job, size_t chunk, wc_ctx_t* partial)
+{
+    size_t begin = chunk * FILE_CHUNK_SIZE;
+    size_t end   = begin + FILE_CHUNK_SIZE < job->size ? begin + FILE_CHUNK_SIZE : job->size;
+
+    bool in_word = begin > 0 && !isspace(job->data[begin - 1]);
+    partial->bytes += end - begin;
+    count_block(job->data + begin, end - begin, &in_word, partial);
+}
+
+static void* file_worker(void* arg)
+{
+    wc_file_worker_t* worker = arg;
+    wc_file_job_t* job = worker->job;
+    while (true) {
+        size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->chunks_count) {
+            break;
+        }
+        count_chunk(job, chunk, &worker->partial);
+    }
+    return NULL;
+}
+
+// Обычный файл считается через mmap пулом из jobs потоков, частичные
+// результаты складываются. Все остальное (pipe, устройства) читается count()
+int count_file(const char* path, size_t jobs, wc_ctx_t* info)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: ", path);
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        wc_stream_t stream = {.fd = fd, .forward_fd = -1, .name = path};
+        int res = count(&stream);
+        *info = stream.info;
+        close(fd);
+        return res < 0 ? -1 : 0;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: ", path);
+        perror("mmap");
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    wc_file_job_t job = {
+        .data         = data,
+        .size         = st.st_size,
+        .chunks_count = (st.st_size + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE,
+    };
+    atomic_init(&job.next_chunk, 0);
+    if (jobs > job.chunks_count) {
+        jobs = job.chunks_count;
+    }
+
+    wc_file_worker_t* workers = calloc(jobs, sizeof(wc_file_worker_t));
+    pthread_t* threads        = calloc(jobs, sizeof(pthread_t));
+    size_t started = 0;
+    if (workers != NULL && threads != NULL) {
+        // нулевой поток - вызывающий, остальные создаются
+        for (size_t i = 0; i < jobs; i++) {
+            workers[i].job = &job;
+        }
+        for (started = 1; started < jobs; started++) {
+            if (pthread_create(&threads[started], NULL, file_worker, &workers[started]) != 0) {
+                break;
+            }
+        }
+        file_worker(&workers[0]);
+        for (size_t i = 1; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (size_t i = 0; i < started; i++) {
+            add_wc_info(info, &workers[i].partial);
+        }
+    } else {
+        wc_file_worker_t single = {.job = &job};
+        file_worker(&single);
+        add_wc_info(info, &single.partial);
+    }
+
+    free(workers);
+    free(threads);
+    munmap(data, st.st_size);
+    return 0;
+}
+
+int count_files(char** paths, int count_paths, size_t jobs)
+{
+    if (jobs == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = online > 0 ? (size_t)online : 1;
+    }
+
+    int res = EXIT_SUCCESS;
+    wc_ctx_t total = {};
+    for (int i = 0; i < count_paths; i++) {
+        wc_ctx_t info = {};
+        if (count_file(paths[i], jobs, &info) < 0) {
+            res = EXIT_FAILURE;
+            continue;
+        }
+        char title[BUFSIZ];
+        snprintf(title, sizeof(title), "%s:", paths[i]);
+        dump_wc_info(stdout, &info, title);
+        add_wc_info(&total, &info);
+    }
+    if (count_paths > 1) {
+        dump_wc_info(stdout, &total, "total:");
+    }
+    return res;
+}
+
+int main(int argc, char** argv) {
+
+    bool tee_mode   = false;
+    double interval = 0;        // 0 - без промежуточных отчетов
+    bool files_mode = false;
+    bool json       = false;
+    size_t jobs     = 0;        // 0 - по числу процессоров
+    const struct option longoptions[] = {
+        {"tee",      0, 0, 't'},
+        {"interval", 1, 0, 'i'},
+        {"files",    0, 0, 'f'},
+        {"jobs",     1, 0, 'j'},
+        {"json",     0, 0, 'J'},
+        {0,          0, 0, 0}
+    };
+    int opt = 0;
+    // '+' - опции только до команды, дальше все аргументы принадлежат ей
+    while ((opt = getopt_long(argc, argv, "+ti:fj:", longoptions, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                tee_mode = true;
+                break;
+            case 'i': {
+                char* end = NULL;
+                interval = strtod(optarg, &end);
+                if (*optarg == '\0' || *end != '\0' || !(interval > 0)) {
+                    fprintf(stderr, "ERROR: --interval expects a positive number of seconds, got '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'f':
+                files_mode = true;
+                break;
+            case 'J':
+                json = true;
+                break;
+            case 'j': {
+                char* end = NULL;
+                long parsed = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || parsed < 1) {
+                    fprintf(stderr, "ERROR: --jobs expects a positive number, got '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                jobs = parsed;
+                break;
+            }
+            default:
+                fprintf(stderr, "usage: %s [--tee] [--interval SECONDS] [--json] command [args...] [-- command [args...]]...\n"
+                                "       %s --files [--jobs N] file...\n", argv[0], argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "too few arguments\n");
+        return EXIT_FAILURE;
+    }
+    if (files_mode) {
+        return count_files(argv + optind, argc - optind, jobs);
+    }
+    wc_command_t* commands = NULL;
+    int commands_count = split_commands(argc - optind, argv + optind, &commands);
+    if (commands_count < 0) {
+        return EXIT_FAILURE;
+    }
 
     // подготовка epoll
 
     int epfd = epoll_create1(0);
     HARD_CHECK(epfd, "epoll create");
 
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
+    // SIGCHLD через signalfd на том же epoll: детей собираем сразу по выходу,
+    // и их wall time не растягивается до конца самой долгой команды.
+    // Сигнал блокируется до fork, чтобы не потерять ранний выход
+    static char sigchld_tag;
+    sigset_t sigchld_mask;
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    HARD_CHECK(sigprocmask(SIG_BLOCK, &sigchld_mask, NULL), "sigprocmask");
+    int sfd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    HARD_CHECK(sfd, "signalfd");
+    struct epoll_event sev;
+    sev.events   = EPOLLIN;
+    sev.data.ptr = &sigchld_tag;
+    HARD_CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &sev), "epoll_ctl: signalfd");
+
+    // все 2N pipe живут на одном epoll
+    int active_fds = 0;
+    for (int cmd = 0; cmd < commands_count; cmd++) {
+        if (spawn_command(&commands[cmd]) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        wc_stream_t* streams = commands[cmd].streams;
+        if (tee_mode) {
+            streams[0].forward_fd = STDOUT_FILENO;
+            streams[1].forward_fd = STDERR_FILENO;
+        }
 
-    ev.data.fd = fd_out;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd_out, &ev) == -1) {
-        perror("epoll_ctl: STDOUT");
-        close(epfd);
-        exit(EXIT_FAILURE);
+        for (int i = 0; i < 2; i++) {
+            // count() дочитывает каждый fd до EAGAIN, поэтому блокироваться на read нельзя
+            HARD_CHECK(set_nonblocking(streams[i].fd), "fcntl");
+            streams[i].forward_pipe = streams[i].forward_fd >= 0 && is_pipe(streams[i].forward_fd);
+
+            struct epoll_event ev;
+            ev.events   = EPOLLIN;
+            ev.data.ptr = &streams[i];
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, streams[i].fd, &ev) == -1) {
+                fprintf(stderr, "%s: ", streams[i].name);
+                perror("epoll_ctl");
+                close(epfd);
+                exit(EXIT_FAILURE);
+            }
+            active_fds++;
+        }
     }
 
-    ev.data.fd = fd_err;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd_err, &ev) == -1) {
-        perror("epoll_ctl: STDERR");
-        close(epfd);
-        exit(EXIT_FAILURE);
+    // событие с data.ptr == NULL - это таймер, а не поток команды
+    int tfd = -1;
+    if (interval > 0) {
+        tfd = create_interval_timer(interval);
+        HARD_CHECK(tfd, "timerfd");
+        struct epoll_event ev;
+        ev.events   = EPOLLIN;
+        ev.data.ptr = NULL;
+        HARD_CHECK(epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev), "epoll_ctl: timerfd");
     }
     // подготовка завершена
 
-    const int MAX_EVENTS = 10;
-    struct epoll_event events[MAX_EVENTS];
+    // с --tee stdout занят выводом команды, поэтому статистика уходит в stderr
+    FILE* report = tee_mode ? stderr : stdout;
+    double start       = now_seconds();
+    double last_report = start;
 
-    wc_ctx_t stdout_info = {};
-    wc_ctx_t stderr_info = {};
+    const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
 
-    int active_fds = 2;
     while (active_fds > 0) {
         int nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
         if (nfds == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             perror("epoll_wait");
             break;
         }
 
         for (int i = 0; i < nfds; i++) {
-            int fd = events[i].data.fd;
-
-            wc_ctx_t* info = (fd == fd_out) ? &stdout_info : &stderr_info;
-            int result = count(fd, info);
+            if (events[i].data.ptr == NULL) {
+                uint64_t expirations = 0;
+                if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    double now = now_seconds();
+                    dump_rates(report, commands, commands_count, now - start, now - last_report);
+                    last_report = now;
+                }
+                continue;
+            }
+            if (events[i].data.ptr == &sigchld_tag) {
+                // несколько SIGCHLD могут слиться в один, поэтому проверяем всех
+                struct signalfd_siginfo info;
+                while (read(sfd, &info, sizeof(info)) == sizeof(info)) {}
+                for (int cmd = 0; cmd < commands_count; cmd++) {
+                    reap_command(&commands[cmd], WNOHANG);
+                }
+                continue;
+            }
+            wc_stream_t* stream = events[i].data.ptr;
+            int result = count(stream);
             if (result <= 0) {
-                close(fd);
+                // явный DEL: пока fd жив в еще не сделавшем exec ребенке, close не снимает его с epoll
+                epoll_ctl(epfd, EPOLL_CTL_DEL, stream->fd, NULL);
+                close(stream->fd);
                 --active_fds;
             }
         }
     }
+    if (tfd >= 0) {
+        close(tfd);
+    }
+    close(sfd);
+    close(epfd);
 
-    dump_wc_info(&stdout_info, "STDOUT:");
-    dump_wc_info(&stderr_info, "STDERR:");
+    for (int cmd = 0; cmd < commands_count; cmd++) {
+        reap_command(&commands[cmd], 0);
+    }
 
-    pid_t closed_pid;
-    while ((closed_pid = wait(NULL)) != -1) {}
+    if (json) {
+        dump_json(report, commands, commands_count);
+    } else if (commands_count == 1) {
+        dump_wc_info(report, &commands[0].streams[0].info, "STDOUT:");
+        dump_wc_info(report, &commands[0].streams[1].info, "STDERR:");
+        dump_usage(report, &commands[0]);
+    } else {
+        wc_ctx_t total_stdout = {};
+        wc_ctx_t total_stderr = {};
+        for (int cmd = 0; cmd < commands_count; cmd++) {
+            fprintf(report, "command #%d: %s\n", cmd + 1, commands[cmd].argv[0]);
+            dump_wc_info(report, &commands[cmd].streams[0].info, "STDOUT:");
+            dump_wc_info(report, &commands[cmd].streams[1].info, "STDERR:");
+            dump_usage(report, &commands[cmd]);
+            add_wc_info(&total_stdout, &commands[cmd].streams[0].info);
+            add_wc_info(&total_stderr, &commands[cmd].streams[1].info);
+        }
+        fprintf(report, "total:\n");
+        dump_wc_info(report, &total_stdout, "STDOUT:");
+        dump_wc_info(report, &total_stderr, "STDERR:");
+    }
 
+    free(commands[0].argv);
+    free(commands);
     return EXIT_SUCCESS;
 }